@@ -0,0 +1,86 @@
+// Library interface of the MIDI splitter.
+//
+// Build midisplitter_lib.cpp and midisplitter_core.cpp and link them into the program:
+//
+//     g++ -std=c++20 -O2 -pthread -c midisplitter_lib.cpp midisplitter_core.cpp
+//
+// A MidiFile maps its input and indexes the tracks once. Each output (MThd header and MTrk
+// chunk, exactly as the splitter would write it) is then handed to a TrackSink as byte spans,
+// which point straight into the mapping where possible, so nothing is copied or written to disk
+// unless the sink does it. Nothing is printed.
+#ifndef MIDISPLITTER_H
+#define MIDISPLITTER_H
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace midisplitter {
+
+struct FileHeader {
+    uint16_t format;      // 0 or 1
+    uint16_t trackCount;
+    uint16_t division;
+};
+
+struct TrackEntry {
+    uint16_t number;         // From 1, in file order
+    std::string name;        // Track name (FF 03), else instrument name, else "Track N"
+    std::string instrument;  // First instrument name (FF 04), may be empty
+    int16_t program;         // First program change, -1 when there is none
+    uint16_t channels;       // Bit n set when channel n + 1 is used before the first non-zero delta-time
+    uint64_t offset;         // Offset of the MTrk chunk in the input
+    uint64_t size;           // Length of the event data, measured again when the MTrk header was wrong
+    bool recovered;          // The MTrk header was wrong; outputs get a corrected one
+};
+
+// Receives outputs. For each one, begin is called with the total number of bytes that will
+// follow, then write with consecutive pieces of the output, then end. The spans are only valid
+// during the call.
+class TrackSink {
+public:
+    virtual ~TrackSink() = default;
+    virtual void begin(const TrackEntry& track, uint64_t outputSize) = 0;
+    virtual void write(std::span<const uint8_t> data) = 0;
+    virtual void end(const TrackEntry& track) = 0;
+};
+
+struct ExtractOptions {
+    // Precede every track but the first with a conductor track holding the tempo, time signature
+    // and key signature events of track 1, as with --conductor
+    bool embedConductor = false;
+};
+
+// A MIDI file opened for extraction. A Format 0 file is its single track; it is not split by
+// channel here. Errors are reported as std::runtime_error.
+// extract and split may be called from several threads at once, with different sinks.
+class MidiFile {
+public:
+    // useIndex: load and keep a "<path>.midx" track index, as with --index
+    explicit MidiFile(const std::string& path, bool useIndex = false);
+    ~MidiFile();
+    MidiFile(MidiFile&&) noexcept;
+    MidiFile& operator=(MidiFile&&) noexcept;
+
+    const FileHeader& header() const;
+    std::span<const TrackEntry> tracks() const;
+
+    // The MTrk chunk of a track (header and event data) as it is in the input
+    std::span<const uint8_t> trackBytes(size_t index) const;
+
+    // Deliver the output of tracks()[index] to sink. Tracks whose data does not fit in one MTrk
+    // chunk (over 4 GB) cannot be delivered as a single output and are rejected.
+    void extract(size_t index, TrackSink& sink, const ExtractOptions& options = {}) const;
+
+    // extract every track in turn
+    void split(TrackSink& sink, const ExtractOptions& options = {}) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace midisplitter
+
+#endif
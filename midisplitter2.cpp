@@ -1,437 +1,929 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <filesystem>
-#include <algorithm>
-#include <iomanip>
-#include <cstdint>
-#include <memory>
-
-#ifdef _WIN32
-    #include <windows.h>
-    #include <commdlg.h>
-    #include <shlobj.h>
-#endif
-
-namespace fs = std::filesystem;
-
-class MIDISplitter {
-private:
-    struct TrackInfo {
-        uint16_t number;
-        std::string name;
-        uint32_t size;
-        std::streampos position;
-    };
-
-    // Convert big-endian bytes to uint32_t
-    uint32_t bytesToUInt32(const std::vector<uint8_t>& bytes, size_t offset = 0) {
-        if (offset + 4 > bytes.size()) return 0;
-        return (static_cast<uint32_t>(bytes[offset]) << 24) |
-               (static_cast<uint32_t>(bytes[offset + 1]) << 16) |
-               (static_cast<uint32_t>(bytes[offset + 2]) << 8) |
-               static_cast<uint32_t>(bytes[offset + 3]);
+// The command line tool: splits one file (prompting for what was not given), batches of files
+// and a watched folder, and merges, inspects or measures files. The splitting itself is
+// midisplitter_core.cpp, which the library (midisplitter_lib.cpp) is built on as well.
+#include "midisplitter_core.h"
+
+// The batch splitter and the search benchmark reach into the splitter as its friends
+namespace midisplitter::detail {
+
+// True for paths ending in .mid or .midi, in any case
+inline bool hasMidiExtension(const fs::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".mid" || extension == ".midi";
+}
+
+// Thread pool in which every worker has a task deque of its own. A worker takes tasks from the
+// back of its own deque and, when that is empty, steals from the front of another worker's
+// deque. Tasks a task submits are pushed to the back of its worker's deque, so they run next on
+// the same worker while their data is still warm, and thieves take the oldest of them. Tasks
+// submitted from outside the pool wait in a shared queue, in submission order, which a worker
+// only takes from when no deque has a task left, so the tasks of a file already started (the
+// tracks of a huge file) are spread over idle workers before the next file is begun. Tasks must
+// not throw.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned workers) : queues_(std::max(1u, workers)) {
+        for (auto& queue : queues_) {
+            queue = std::make_unique<Queue>();
+        }
+        for (unsigned worker = 0; worker < queues_.size(); worker++) {
+            threads_.emplace_back([this, worker] { work(worker); });
+        }
     }
 
-    // Convert big-endian bytes to uint16_t
-    uint16_t bytesToUInt16(const std::vector<uint8_t>& bytes, size_t offset = 0) {
-        if (offset + 2 > bytes.size()) return 0;
-        return (static_cast<uint16_t>(bytes[offset]) << 8) |
-               static_cast<uint16_t>(bytes[offset + 1]);
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
     }
 
-    // Convert uint32_t to big-endian bytes
-    std::vector<uint8_t> uint32ToBytes(uint32_t value) {
-        return {
-            static_cast<uint8_t>((value >> 24) & 0xFF),
-            static_cast<uint8_t>((value >> 16) & 0xFF),
-            static_cast<uint8_t>((value >> 8) & 0xFF),
-            static_cast<uint8_t>(value & 0xFF)
-        };
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        Queue& queue = currentPool_ == this ? *queues_[currentWorker_] : injector_;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_++;
+        }
+        wake_.notify_one();
     }
 
-    // Convert uint16_t to big-endian bytes
-    std::vector<uint8_t> uint16ToBytes(uint16_t value) {
-        return {
-            static_cast<uint8_t>((value >> 8) & 0xFF),
-            static_cast<uint8_t>(value & 0xFF)
-        };
+    // Wait until every task, including the tasks submitted by tasks, has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
     }
 
-    // Simple search instead of KMP for reliability
-    std::vector<size_t> simpleSearch(const std::vector<uint8_t>& text, const std::vector<uint8_t>& pattern) {
-        std::vector<size_t> result;
-        if (pattern.empty() || text.size() < pattern.size()) return result;
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
 
-        for (size_t i = 0; i <= text.size() - pattern.size(); i++) {
-            bool match = true;
-            for (size_t j = 0; j < pattern.size(); j++) {
-                if (text[i + j] != pattern[j]) {
-                    match = false;
-                    break;
-                }
+    bool take(size_t worker, std::function<void()>& task) {
+        {
+            Queue& own = *queues_[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
             }
-            if (match) {
-                result.push_back(i);
-                i += pattern.size() - 1; // Skip ahead
+        }
+        for (size_t offset = 1; offset < queues_.size(); offset++) {
+            Queue& victim = *queues_[(worker + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
             }
         }
-        return result;
+        std::lock_guard<std::mutex> lock(injector_.mutex);
+        if (!injector_.tasks.empty()) {
+            task = std::move(injector_.tasks.front());
+            injector_.tasks.pop_front();
+            return true;
+        }
+        return false;
     }
 
-    // Extract track name from track data
-    std::string extractTrackName(std::istream& stream, uint16_t trackNumber, uint32_t trackSize) {
-        const size_t MAX_SEARCH_SIZE = 1024; // Reduced for safety
-        size_t searchSize = std::min(static_cast<size_t>(trackSize), MAX_SEARCH_SIZE);
-        
-        std::vector<uint8_t> searchBuffer;
-        try {
-            searchBuffer.resize(searchSize);
-        } catch (const std::bad_alloc& e) {
-            return "Track " + std::to_string(trackNumber);
-        }
-        
-        std::streampos currentPos = stream.tellg();
-        if (currentPos == -1) {
-            return "Track " + std::to_string(trackNumber);
-        }
-
-        stream.read(reinterpret_cast<char*>(searchBuffer.data()), searchSize);
-        if (!stream) {
-            stream.clear(); // Clear error state
-            stream.seekg(currentPos);
-            return "Track " + std::to_string(trackNumber);
-        }
-        
-        stream.seekg(currentPos); // Rewind the stream
-        stream.clear(); // Ensure stream is in good state
-
-        std::vector<uint8_t> pattern = {0xFF, 0x03}; // Track name meta event
-        auto matches = simpleSearch(searchBuffer, pattern);
-
-        if (!matches.empty()) {
-            for (auto matchPos : matches) {
-                size_t nameIndex = matchPos + 2; // Skip the meta event bytes
-                if (nameIndex + 1 < searchBuffer.size()) {
-                    uint8_t nameLength = searchBuffer[nameIndex];
-                    if (nameIndex + 1 + nameLength <= searchBuffer.size()) {
-                        std::string trackName;
-                        for (size_t i = 0; i < nameLength; i++) {
-                            trackName += static_cast<char>(searchBuffer[nameIndex + 1 + i]);
-                        }
-                        if (!trackName.empty()) {
-                            return trackName;
-                        }
-                    }
+    void work(size_t worker) {
+        currentPool_ = this;
+        currentWorker_ = worker;
+        while (true) {
+            std::function<void()> task;
+            if (take(worker, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    queued_--; // May go below zero until the submitter has counted the task
                 }
+                task();
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    done_.notify_all();
+                }
+                continue;
             }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+            if (stopping_ && queued_ <= 0) return;
         }
+    }
 
-        return "Track " + std::to_string(trackNumber);
+    std::vector<std::unique_ptr<Queue>> queues_;
+    Queue injector_;                // Tasks submitted from outside the pool
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;  // Workers with nothing to take
+    std::condition_variable done_;  // wait()
+    int64_t queued_ = 0;            // Tasks in the deques and the injector
+    int64_t pending_ = 0;           // Tasks submitted and not finished
+    bool stopping_ = false;
+
+    static inline thread_local WorkStealingPool* currentPool_ = nullptr;
+    static inline thread_local size_t currentWorker_ = 0;
+};
+
+// Splits many inputs at once on a shared work-stealing pool, for the batch (-o) and watch modes
+class BatchSplitter {
+private:
+    using TrackInfo = MIDISplitter::TrackInfo;
+    using SplitPlan = MIDISplitter::SplitPlan;
+    using PlannedOutputs = MIDISplitter::PlannedOutputs;
+
+    std::ostream& log_;
+
+    // One input split on a shared pool (batch and watch modes). It logs into a buffer of its own,
+    // which the owner prints in one piece from finished, so files split at the same time never mix.
+    struct PoolSplit {
+        std::string inputFile;
+        std::string outputDir;
+        SplitOptions options;
+        std::ostringstream log;
+        std::unique_ptr<MIDISplitter> splitter;
+        SplitPlan plan;
+        PlannedOutputs* planned = nullptr;         // Shared with the other splits on the pool
+        std::atomic<size_t> remaining{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;                  // The first error, written by whoever set failed
+        std::function<void(PoolSplit&)> finished;  // Called once, by the task that completes the file
+    };
+
+    std::shared_ptr<PoolSplit> makePoolSplit(const std::string& inputFile, const std::string& outputDir,
+                                             const SplitOptions& options, std::function<void(PoolSplit&)> finished) {
+        auto file = std::make_shared<PoolSplit>();
+        file->inputFile = inputFile;
+        file->outputDir = outputDir;
+        file->options = options;
+        file->splitter = std::make_unique<MIDISplitter>(file->log);
+        file->finished = std::move(finished);
+        return file;
     }
 
-    // Get safe filename
-    std::string getSafeFilename(const std::string& name) {
-        std::string safe = name;
-        std::string invalid = "<>:\"/\\|?*";
-        for (char c : invalid) {
-            std::replace(safe.begin(), safe.end(), c, '_');
+    static void failPoolSplit(PoolSplit& file) {
+        if (!file.failed.exchange(true)) {
+            file.error = std::current_exception();
         }
-        return safe;
     }
 
-    // Copy data from one stream to another in chunks
-    void copyStream(std::istream& in, std::ostream& out, size_t size) {
-        const size_t BUFFER_SIZE = 4096;
-        std::vector<char> buffer(BUFFER_SIZE);
-        
-        while (size > 0) {
-            size_t bytesToRead = std::min(size, BUFFER_SIZE);
-            in.read(buffer.data(), bytesToRead);
-            if (in.gcount() == 0) break; // No more data to read
-            
-            out.write(buffer.data(), in.gcount());
-            if (!out) {
-                throw std::runtime_error("Error writing to output stream.");
+    // Log the outcome of a split, release its input and hand it to its owner
+    void finishPoolSplit(PoolSplit& file) {
+        MIDISplitter& splitter = *file.splitter;
+        if (file.failed) {
+            try {
+                std::rethrow_exception(file.error);
+            } catch (const std::exception& e) {
+                file.log << "Error: " << e.what() << std::endl;
+            }
+        } else if (file.plan.input) {
+            for (size_t index = 0; index < file.plan.tracks.size(); index++) {
+                splitter.printSplitResult(file.plan.tracks[index], file.plan.outputPaths[index], file.plan.partCounts[index]);
+            }
+            if (splitter.reflinkRefused) {
+                file.log << "\n(Filesystem refused to clone track data, it was copied instead)" << std::endl;
+            }
+            if (splitter.directRefused) {
+                file.log << "\n(Filesystem does not support O_DIRECT, outputs were written through the page cache)" << std::endl;
             }
-            
-            size -= in.gcount();
-            if (in.eof()) break; // Reached end of file
+            file.log << "\nSuccessfully split " << file.plan.tracks.size() << " tracks!" << std::endl;
         }
-    }
 
-#ifdef _WIN32
-    // Windows file dialog
-    std::string openFileDialog() {
-        OPENFILENAMEA ofn;
-        char szFile[260] = {0};
-
-        ZeroMemory(&ofn, sizeof(ofn));
-        ofn.lStructSize = sizeof(ofn);
-        ofn.lpstrFile = szFile;
-        ofn.nMaxFile = sizeof(szFile);
-        ofn.lpstrFilter = "MIDI Files\0*.mid;*.midi\0All Files\0*.*\0";
-        ofn.nFilterIndex = 1;
-        ofn.lpstrTitle = "Select MIDI File to Split";
-        ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
-
-        if (GetOpenFileNameA(&ofn)) {
-            return std::string(szFile);
-        }
-        return "";
+        // The outputs exist now, so they no longer need to be remembered
+        if (file.planned != nullptr && !file.plan.outputPaths.empty()) {
+            std::lock_guard<std::mutex> lock(file.planned->mutex);
+            for (const auto& path : file.plan.outputPaths) {
+                file.planned->paths.erase(path);
+            }
+            for (const auto& path : file.plan.partPaths) {
+                file.planned->paths.erase(path);
+            }
+        }
+        file.plan = SplitPlan();
+        file.finished(file);
     }
 
-    std::string selectFolderDialog() {
-        BROWSEINFOA bi = {0};
-        bi.lpszTitle = "Select Output Folder";
-        bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
-
-        LPITEMIDLIST pidl = SHBrowseForFolderA(&bi);
-        if (pidl != nullptr) {
-            char path[MAX_PATH];
-            if (SHGetPathFromIDListA(pidl, path)) {
-                CoTaskMemFree(pidl);
-                return std::string(path);
+    // Queue the split of one file on pool. Reading and planning the file is one task, which
+    // submits a task per track to its worker's own deque; idle workers steal them, so the tracks
+    // of a large file spread over every worker while other files finish around it.
+    void submitPoolSplit(WorkStealingPool& pool, std::shared_ptr<PoolSplit> file, PlannedOutputs& planned) {
+        file->planned = &planned;
+        pool.submit([this, &pool, file, &planned] {
+            MIDISplitter& splitter = *file->splitter;
+            const std::string& outputDir = file->outputDir;
+            const SplitOptions& options = file->options;
+            try {
+                // Streams and Format 0 files are split in one pass by this task
+                if (options.singlePass || !fs::is_regular_file(file->inputFile)) {
+                    splitter.splitMIDIFile(file->inputFile, outputDir, options, &planned);
+                    finishPoolSplit(*file);
+                    return;
+                }
+
+                file->log << "Reading MIDI file: " << file->inputFile << std::endl;
+                file->plan = splitter.planSplit(file->inputFile, outputDir, options, &planned);
+                if (file->plan.header.format == 0) {
+                    file->plan.input.reset();
+                    std::ifstream in(file->inputFile, std::ios::binary);
+                    if (!in.seekg(14)) {
+                        throw std::runtime_error("Cannot open file: " + file->inputFile);
+                    }
+                    splitter.splitFormat0(in, file->plan.header, fs::path(file->inputFile).stem().string(), outputDir, options, &planned);
+                    finishPoolSplit(*file);
+                    return;
+                }
+            } catch (...) {
+                failPoolSplit(*file);
+                finishPoolSplit(*file);
+                return;
             }
-            CoTaskMemFree(pidl);
-        }
-        return "";
+
+            if (file->plan.tracks.empty()) {
+                finishPoolSplit(*file);
+                return;
+            }
+            file->remaining = file->plan.tracks.size();
+            for (size_t index = 0; index < file->plan.tracks.size(); index++) {
+                pool.submit([this, file, index] {
+                    if (!file->failed) {
+                        try {
+                            const TrackInfo& track = file->plan.tracks[index];
+                            file->plan.partCounts[index] =
+                                file->splitter->writeTrackFile(*file->plan.input, file->plan.outputPaths[index],
+                                                               file->plan.headers.forTrack(track), track, file->options);
+                        } catch (...) {
+                            failPoolSplit(*file);
+                        }
+                    }
+                    if (--file->remaining == 0) {
+                        finishPoolSplit(*file);
+                    }
+                });
+            }
+        });
     }
-#endif
 
 public:
-    void splitMIDIFile(const std::string& inputFile, const std::string& outputDir) {
-        std::cout << "Reading MIDI file: " << inputFile << std::endl;
-
-        // Use RAII for file handling
-        std::ifstream file(inputFile, std::ios::binary);
-        if (!file) {
-            throw std::runtime_error("Cannot open file: " + inputFile);
+    explicit BatchSplitter(std::ostream& log = std::cout) : log_(log) {}
+
+    // Split many files at once on a shared work-stealing pool. Returns the number of files that
+    // could not be split.
+    int splitBatch(const std::vector<std::string>& inputFiles, const std::string& outputDir, const SplitOptions& options) {
+        unsigned workers = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+        log_ << "Splitting " << inputFiles.size() << " files on " << workers << " thread" << (workers == 1 ? "" : "s")
+             << " into " << outputDir << std::endl;
+        if (options.ioUring) {
+            log_ << "Note: --io-uring is not used in batch mode" << std::endl;
         }
 
-        // Read and validate MIDI header
-        std::vector<uint8_t> headerData(14);
-        file.read(reinterpret_cast<char*>(headerData.data()), 14);
-        if (!file || file.gcount() != 14) {
-            throw std::runtime_error("Error reading MIDI header.");
+        std::mutex printMutex;
+        std::atomic<int> failures{0};
+        auto finished = [&](PoolSplit& file) {
+            if (file.failed) failures++;
+            std::lock_guard<std::mutex> lock(printMutex);
+            log_ << std::endl << file.log.str() << std::flush;
+        };
+
+        // Big files first, so their tracks are spread over the pool while the small files run.
+        // Each input is stat'ed once; one that cannot be (gone, a pipe) sorts as empty and
+        // reports its error when it is split.
+        std::vector<std::pair<uint64_t, size_t>> order;
+        order.reserve(inputFiles.size());
+        for (size_t index = 0; index < inputFiles.size(); index++) {
+            std::error_code error;
+            uint64_t size = fs::file_size(inputFiles[index], error);
+            order.emplace_back(error ? 0 : size, index);
         }
+        std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
 
-        std::string header(headerData.begin(), headerData.begin() + 4);
-        if (header != "MThd") {
-            throw std::runtime_error("Not a valid MIDI file (missing MThd header)");
+        PlannedOutputs planned;
+        WorkStealingPool pool(workers);
+        for (const auto& [size, index] : order) {
+            submitPoolSplit(pool, makePoolSplit(inputFiles[index], outputDir, options, finished), planned);
         }
+        pool.wait();
 
-        uint32_t headerSize = bytesToUInt32(headerData, 4);
-        if (headerSize != 6) {
-            throw std::runtime_error("Invalid MIDI header size");
+        log_ << std::endl << "Split " << inputFiles.size() - failures << " of " << inputFiles.size() << " files" << std::endl;
+        return failures;
+    }
+
+    // Split every MIDI file that is written into or moved into spoolDir until SIGINT or SIGTERM,
+    // on a pool of workers started once. inotify reports a file when its writer closes it
+    // (IN_CLOSE_WRITE) or when it is renamed into the folder (IN_MOVED_TO), so half-written
+    // files are never picked up. Files already in the folder are left alone. Linux only.
+    void watchDirectory(const std::string& spoolDir, const std::string& outputDir, const SplitOptions& options) {
+#ifdef __linux__
+        std::error_code error;
+        if (fs::equivalent(spoolDir, outputDir, error)) {
+            throw std::runtime_error("The output folder must not be the watched folder");
         }
 
-        uint16_t format = bytesToUInt16(headerData, 8);
-        if (format != 1) {
-            throw std::runtime_error("Not a Format 1 MIDI file");
+        FileDescriptor inotify(::inotify_init1(IN_CLOEXEC));
+        if (!inotify) {
+            throw std::runtime_error(std::string("Cannot start inotify: ") + std::strerror(errno));
+        }
+        if (::inotify_add_watch(inotify.get(), spoolDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+            throw std::runtime_error("Cannot watch " + spoolDir + ": " + std::strerror(errno));
         }
 
-        uint16_t totalTracks = bytesToUInt16(headerData, 10);
-        std::vector<uint8_t> division(headerData.begin() + 12, headerData.end());
+        // SIGINT and SIGTERM are blocked before the pool starts, so its threads inherit the mask
+        // and the signals are only ever received here, through the signalfd polled below. An
+        // ignored signal is discarded before it can be queued, as for a background job started
+        // by a script, so both are set back to their default action first.
+        ::signal(SIGINT, SIG_DFL);
+        ::signal(SIGTERM, SIG_DFL);
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        sigset_t previousMask;
+        ::pthread_sigmask(SIG_BLOCK, &stopSignals, &previousMask);
+        FileDescriptor signals(::signalfd(-1, &stopSignals, SFD_CLOEXEC));
+        if (!signals) {
+            int signalError = errno;
+            ::pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+            throw std::runtime_error(std::string("Cannot start signalfd: ") + std::strerror(signalError));
+        }
 
-        std::cout << "Found " << totalTracks << " tracks to split" << std::endl;
+        unsigned workers = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+        log_ << "Watching " << spoolDir << " for MIDI files, splitting into " << outputDir << " on " << workers
+             << " thread" << (workers == 1 ? "" : "s") << " (Ctrl+C to stop)" << std::endl;
 
-        std::vector<TrackInfo> tracks;
-        tracks.reserve(totalTracks); // Reserve space for ALL tracks including primary
+        std::mutex printMutex;
+        auto finished = [&](PoolSplit& file) {
+            std::lock_guard<std::mutex> lock(printMutex);
+            log_ << std::endl << file.log.str() << std::flush;
+        };
 
-        // Process ALL tracks including the primary track
-        for (uint16_t i = 0; i < totalTracks; i++) {
-            std::streampos trackStartPos = file.tellg();
-            if (trackStartPos == -1) {
-                throw std::runtime_error("Invalid file position at track " + std::to_string(i + 1));
+        PlannedOutputs planned;
+        WorkStealingPool pool(workers);
+        alignas(inotify_event) char buffer[64 << 10];
+        bool stopping = false;
+        while (!stopping) {
+            pollfd ready[2] = {{inotify.get(), POLLIN, 0}, {signals.get(), POLLIN, 0}};
+            if (::poll(ready, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("Error waiting for inotify events: ") + std::strerror(errno));
             }
-
-            std::vector<uint8_t> trackHeader(8);
-            file.read(reinterpret_cast<char*>(trackHeader.data()), 8);
-            if (!file || file.gcount() != 8) {
-                throw std::runtime_error("Error reading track header " + std::to_string(i + 1));
+            if (ready[1].revents & POLLIN) {
+                signalfd_siginfo received;
+                if (::read(signals.get(), &received, sizeof(received)) == sizeof(received)) break;
             }
+            if (!(ready[0].revents & POLLIN)) continue;
 
-            std::string trackHeaderStr(trackHeader.begin(), trackHeader.begin() + 4);
-            if (trackHeaderStr != "MTrk") {
-                throw std::runtime_error("Invalid track header for track " + std::to_string(i + 1));
+            ssize_t length = ::read(inotify.get(), buffer, sizeof(buffer));
+            if (length < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("Error reading inotify events: ") + std::strerror(errno));
             }
 
-            uint32_t trackSize = bytesToUInt32(trackHeader, 4);
+            for (ssize_t offset = 0; offset < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
 
-            TrackInfo track;
-            track.number = i + 1;
-            track.size = trackSize;
-            track.position = trackStartPos;
-            
-            // Extract track name with proper error handling
-            try {
-                track.name = extractTrackName(file, track.number, trackSize);
-            } catch (...) {
-                if (i == 0) {
-                    track.name = "Tempo Track"; // Special name for primary track
-                } else {
-                    track.name = "Track " + std::to_string(track.number);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    std::lock_guard<std::mutex> lock(printMutex);
+                    log_ << "Note: too many files arrived at once, some of them were missed" << std::endl;
                 }
-            }
-            
-            tracks.push_back(track);
-            
-            if (i == 0) {
-                std::cout << "Primary Track: " << track.name << " (" << track.size << " bytes)" << std::endl;
-            } else {
-                std::cout << "Track " << track.number << ": " << track.name << " (" << track.size << " bytes)" << std::endl;
-            }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    std::lock_guard<std::mutex> lock(printMutex);
+                    log_ << "The watched folder was removed or moved, stopping" << std::endl;
+                    stopping = true;
+                    break;
+                }
+                if (event->len == 0 || (event->mask & IN_ISDIR)) continue;
 
-            // Seek to next track
-            file.seekg(trackSize, std::ios::cur);
-            if (!file) {
-                throw std::runtime_error("Error seeking to next track " + std::to_string(i + 1));
+                fs::path inputPath = fs::path(spoolDir) / event->name;
+                if (hasMidiExtension(inputPath)) {
+                    submitPoolSplit(pool, makePoolSplit(inputPath.string(), outputDir, options, finished), planned);
+                }
             }
         }
 
-        // Prepare output header for Format 1 (single track)
-        std::vector<uint8_t> outputHeader;
-        outputHeader.reserve(14);
-        
-        // MThd header
-        outputHeader.insert(outputHeader.end(), {'M', 'T', 'h', 'd'});
-        
-        // Header size (6 bytes)
-        auto headerSizeBytes = uint32ToBytes(6);
-        outputHeader.insert(outputHeader.end(), headerSizeBytes.begin(), headerSizeBytes.end());
-        
-        // Format (1 = format 1 - single track)
-        auto formatBytes = uint16ToBytes(1);
-        outputHeader.insert(outputHeader.end(), formatBytes.begin(), formatBytes.end());
-        
-        // Number of tracks (1 - single track)
-        auto trackCountBytes = uint16ToBytes(1);
-        outputHeader.insert(outputHeader.end(), trackCountBytes.begin(), trackCountBytes.end());
-        
-        // Division (unchanged)
-        outputHeader.insert(outputHeader.end(), division.begin(), division.end());
-
-        fs::path inputPath(inputFile);
-        std::string baseName = inputPath.stem().string();
-
-        // Create output files - each containing only ONE track
-        int splitCount = 0;
-        for (const auto& track : tracks) {
-            std::string trackType = (track.number == 1) ? "Tempo" : "Track";
-            std::cout << "Splitting: " << trackType << " " << track.number << std::endl;
-            
-            std::string safeTrackName = getSafeFilename(track.name);
-            std::string outputFile;
-            
-            outputFile = baseName + " - " + safeTrackName + ".mid";
-            
-            fs::path outputPath = fs::path(outputDir) / outputFile;
-            
-            int counter = 1;
-            while (fs::exists(outputPath)) {
-                outputFile = baseName + " - " + safeTrackName + " (Copy " + std::to_string(counter) + ").mid";
-            }
-            outputPath = fs::path(outputDir) / outputFile;
-            counter++;
+        log_ << std::endl << "Stopping, finishing the splits in progress..." << std::endl;
+        pool.wait();
+        ::pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+#else
+        (void)spoolDir;
+        (void)outputDir;
+        (void)options;
+        throw std::runtime_error("Watching a folder is only supported on Linux");
+#endif
+    }
+};
 
-            std::ofstream outFile(outputPath, std::ios::binary);
-            if (!outFile) {
-                throw std::runtime_error("Cannot create output file: " + outputPath.string());
+// Original byte-by-byte search, kept as the reference for --bench-search
+std::vector<size_t> simpleSearch(std::span<const uint8_t> text, const std::vector<uint8_t>& pattern) {
+    std::vector<size_t> result;
+    if (pattern.empty() || text.size() < pattern.size()) return result;
+
+    for (size_t i = 0; i <= text.size() - pattern.size(); i++) {
+        bool match = true;
+        for (size_t j = 0; j < pattern.size(); j++) {
+            if (text[i + j] != pattern[j]) {
+                match = false;
+                break;
             }
+        }
+        if (match) {
+            result.push_back(i);
+            i += pattern.size() - 1; // Skip ahead
+        }
+    }
+    return result;
+}
+
+// Microbenchmark of the track-name locator against the original simpleSearch routine, on
+// windows with the name meta event at the very end: note events only (FF is absent, the
+// memchr best case) and back-to-back text meta events (FF every four bytes, like the
+// copyright/text/marker block at the start of many tracks)
+void benchmarkNameSearch() {
+    MIDISplitter splitter;
+    auto timeRoutine = [](const char* label, size_t windowSize, auto&& routine) {
+        size_t iterations = std::max<size_t>(16, (size_t(256) << 20) / windowSize);
+        size_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            sink += routine();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double perCall = elapsed.count() / static_cast<double>(iterations);
+        std::cout << "  " << std::left << std::setw(14) << label << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << perCall * 1e9 << " ns/call" << std::setw(10)
+                  << static_cast<double>(windowSize) / perCall / (1 << 20) << " MB/s" << std::endl;
+        return sink / iterations;
+    };
 
-            // Write header (Format 1, single track)
-            outFile.write(reinterpret_cast<const char*>(outputHeader.data()), outputHeader.size());
-            if (!outFile) {
-                throw std::runtime_error("Error writing header to: " + outputPath.string());
+    for (int metaHeavy = 0; metaHeavy < 2; metaHeavy++)
+    for (size_t windowSize : {size_t(1) << 10, size_t(1) << 20}) {
+        const uint8_t name[] = {0x00, 0xFF, 0x03, 0x05, 'P', 'i', 'a', 'n', 'o'};
+        std::vector<uint8_t> window;
+        window.reserve(windowSize);
+        window.push_back(0x00);
+        window.push_back(0x90);
+        while (window.size() + 4 + sizeof(name) <= windowSize) {
+            uint8_t note = static_cast<uint8_t>(36 + window.size() % 48);
+            // Running-status note on/off pairs, or empty text events
+            const uint8_t notes[] = {note, 0x64, 0x78, note};
+            const uint8_t texts[] = {0xFF, 0x01, 0x00, 0x00};
+            const uint8_t* events = metaHeavy ? texts : notes;
+            window.insert(window.end(), events, events + 4);
+        }
+        window.resize(windowSize - sizeof(name), 0x00);
+        window.insert(window.end(), std::begin(name), std::end(name));
+        // Re-read through a volatile on every call so the compiler cannot hoist the search out of the loop
+        volatile size_t length = window.size();
+        auto view = [&] { return std::span<const uint8_t>(window.data(), length); };
+
+        std::cout << (windowSize >> 10) << " KB window, " << (metaHeavy ? "text meta events" : "note events")
+                  << ":" << std::endl;
+        size_t expected = windowSize - sizeof(name) + 1;
+        const std::vector<uint8_t> pattern = {0xFF, 0x03};
+        size_t results[] = {
+            timeRoutine("simpleSearch", windowSize, [&] {
+                auto bytes = view();
+                for (size_t matchPos : simpleSearch(bytes, pattern)) {
+                    size_t nameIndex = matchPos + 2;
+                    if (nameIndex + 1 < bytes.size() && bytes[nameIndex] != 0 &&
+                        nameIndex + 1 + bytes[nameIndex] <= bytes.size()) {
+                        return matchPos;
+                    }
+                }
+                return bytes.size();
+            }),
+            timeRoutine("locator", windowSize, [&] { return splitter.locateNameMeta(view()); }),
+            timeRoutine("  scalar", windowSize, [&] { auto bytes = view(); return findNameMetaScalar(bytes.data(), bytes.size(), 0); }),
+#ifdef MIDISPLITTER_HAVE_SSE2
+            timeRoutine("  sse2", windowSize, [&] { auto bytes = view(); return findNameMetaSSE2(bytes.data(), bytes.size(), 0); }),
+#endif
+        };
+#ifdef MIDISPLITTER_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            if (timeRoutine("  avx2", windowSize, [&] { auto bytes = view(); return findNameMetaAVX2(bytes.data(), bytes.size(), 0); }) != expected) {
+                throw std::runtime_error("Name search results disagree");
             }
-
-            // Write ONLY this track (no other tracks included)
-            file.clear();
-            file.seekg(track.position);
-            if (!file) {
-                throw std::runtime_error("Error seeking to track " + std::to_string(track.number));
+        }
+#endif
+        for (size_t result : results) {
+            if (result != expected) {
+                throw std::runtime_error("Name search results disagree");
             }
-            
-            // Write the track header and data (8 bytes header + track data)
-            copyStream(file, outFile, 8 + track.size);
-
-            outFile.close();
-            splitCount++;
-            
-            std::cout << "  -> Created: " << outputFile << std::endl;
         }
-
-        std::cout << "\nSuccessfully split " << splitCount << " tracks!" << std::endl;
     }
+}
 
-    void run() {
 #ifdef _WIN32
-        // Initialize COM for Windows dialogs
-        CoInitialize(NULL);
+// Windows file dialog
+std::string openFileDialog() {
+    OPENFILENAMEA ofn;
+    char szFile[260] = {0};
+
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile);
+    ofn.lpstrFilter = "MIDI Files\0*.mid;*.midi\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrTitle = "Select MIDI File to Split";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+
+    if (GetOpenFileNameA(&ofn)) {
+        return std::string(szFile);
+    }
+    return "";
+}
+
+std::string selectFolderDialog() {
+    BROWSEINFOA bi = {0};
+    bi.lpszTitle = "Select Output Folder";
+    bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+
+    LPITEMIDLIST pidl = SHBrowseForFolderA(&bi);
+    if (pidl != nullptr) {
+        char path[MAX_PATH];
+        if (SHGetPathFromIDListA(pidl, path)) {
+            CoTaskMemFree(pidl);
+            return std::string(path);
+        }
+        CoTaskMemFree(pidl);
+    }
+    return "";
+}
 #endif
 
-        try {
-            std::string inputFile, outputDir;
+// Split one file, prompting for whichever of the input file and output folder was not given
+int run(const SplitOptions& options, std::string inputFile, std::string outputDir) {
+    bool interactive = inputFile.empty() || outputDir.empty();
+    int exitCode = 0;
+
+#ifdef _WIN32
+    // Initialize COM for Windows dialogs
+    CoInitialize(NULL);
+#endif
 
+    try {
 #ifdef _WIN32
-            // Use Windows dialogs
+        // Use Windows dialogs
+        if (inputFile.empty()) {
             std::cout << "Select MIDI file to split..." << std::endl;
             inputFile = openFileDialog();
             if (inputFile.empty()) {
                 std::cout << "No file selected. Exiting." << std::endl;
-                return;
+                return 0;
             }
+        }
 
+        if (outputDir.empty()) {
             std::cout << "Select output folder..." << std::endl;
             outputDir = selectFolderDialog();
             if (outputDir.empty()) {
                 std::cout << "No output folder selected. Exiting." << std::endl;
-                return;
+                return 0;
             }
+        }
 #else
-            // Command line input for non-Windows
+        // Command line input for non-Windows
+        if (inputFile.empty()) {
             std::cout << "Enter MIDI file path: ";
             std::getline(std::cin, inputFile);
-            
+        }
+
+        if (outputDir.empty()) {
             std::cout << "Enter output directory: ";
             std::getline(std::cin, outputDir);
+        }
 #endif
 
-            // Validate input file
-            if (!fs::exists(inputFile)) {
-                throw std::runtime_error("Input file does not exist: " + inputFile);
+        // Validate input file ("-" reads the MIDI data from stdin)
+        if (inputFile != "-" && !fs::exists(inputFile)) {
+            throw std::runtime_error("Input file does not exist: " + inputFile);
+        }
+
+        // Validate/create output directory
+        if (!fs::exists(outputDir)) {
+            if (!fs::create_directories(outputDir)) {
+                throw std::runtime_error("Cannot create output directory: " + outputDir);
             }
+        }
+
+        MIDISplitter().splitMIDIFile(inputFile, outputDir, options);
+
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+#ifdef _WIN32
+    CoUninitialize();
+#endif
 
-            // Validate/create output directory
-            if (!fs::exists(outputDir)) {
-                if (!fs::create_directories(outputDir)) {
-                    throw std::runtime_error("Cannot create output directory: " + outputDir);
+    if (interactive) {
+        std::cout << "\nPress Enter to exit...";
+        std::cin.get();
+    }
+    return exitCode;
+}
+
+// Parse a track list like "2,5-9" into inclusive ranges
+std::vector<std::pair<uint16_t, uint16_t>> parseTrackRanges(const std::string& list) {
+    std::vector<std::pair<uint16_t, uint16_t>> ranges;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        std::string item = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t dash = item.find('-');
+        size_t firstLength = 0, lastLength = 0;
+        unsigned long first = std::stoul(item.substr(0, dash), &firstLength);
+        unsigned long last = first;
+        if (dash != std::string::npos) {
+            last = std::stoul(item.substr(dash + 1), &lastLength);
+        }
+        if (firstLength != (dash == std::string::npos ? item.size() : dash) ||
+            (dash != std::string::npos && lastLength != item.size() - dash - 1) ||
+            first == 0 || last < first || last > 65535) {
+            throw std::invalid_argument(item);
+        }
+        ranges.emplace_back(static_cast<uint16_t>(first), static_cast<uint16_t>(last));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return ranges;
+}
+
+// Parse a whole decimal number no larger than max; signs, spaces and trailing characters are refused
+uint64_t parseCount(const std::string& text, uint64_t max) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+        throw std::invalid_argument(text);
+    }
+    size_t length = 0;
+    uint64_t value = std::stoull(text, &length);
+    if (length != text.size() || value > max) {
+        throw std::invalid_argument(text);
+    }
+    return value;
+}
+
+// Parse a byte count with an optional K, M or G (binary) suffix; the number is parsed as by
+// parseCount, so signs and spaces are refused
+uint64_t parseByteSize(const std::string& text) {
+    size_t digits = 0;
+    while (digits < text.size() && std::isdigit(static_cast<unsigned char>(text[digits]))) digits++;
+    std::string suffix = text.substr(digits);
+    int shift = suffix.empty() ? 0 : suffix == "K" || suffix == "k" ? 10 : suffix == "M" ? 20 : suffix == "G" ? 30 : -1;
+    if (shift < 0) {
+        throw std::invalid_argument(text);
+    }
+    return parseCount(text.substr(0, digits), std::numeric_limits<uint64_t>::max() >> shift) << shift;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options] [input.mid [output-dir]]" << std::endl
+              << "       " << program << " [split] [options] input.mid|dir... -o output-dir" << std::endl
+              << "       " << program << " --merge output.mid input.mid..." << std::endl
+              << "       " << program << " [options] --watch spool-dir -o output-dir" << std::endl
+              << "Prompts for the input file and output folder when they are not given." << std::endl << std::endl
+              << "Options:" << std::endl
+              << "  --reflink    Align track data to filesystem blocks and clone it instead of copying (Linux)" << std::endl
+              << "  --stream     Read the input in a single forward pass (implied for pipes and \"-\" = stdin)" << std::endl
+              << "  --jobs N     Write N tracks at a time (0 = one per CPU core)" << std::endl
+              << "  --io-uring   Batch opens and writes of small tracks through io_uring (Linux, not with --reflink)" << std::endl
+              << "  --cache-window MB  Keep at most about MB megabytes of each input/output in the page cache (Linux)" << std::endl
+              << "  --direct     Write outputs with O_DIRECT, bypassing the page cache (Linux)" << std::endl
+              << "  --index      Reuse/keep a <input>.midx track index next to the input" << std::endl
+              << "  --inspect    Print the track table of input.mid as JSON instead of splitting" << std::endl
+              << "  --stats      Print per-track note counts, length, polyphony and channels of input.mid" << std::endl
+              << "  --tracks LIST      Only write these tracks, e.g. 2,5-9" << std::endl
+              << "  --name-regex RE    Only write tracks whose name contains a match for RE" << std::endl
+              << "  --min-size BYTES   Only write tracks with at least this much data (K/M/G suffixes allowed)" << std::endl
+              << "  --max-size BYTES   Only write tracks with at most this much data" << std::endl
+              << "  --max-part-size BYTES  Cut larger outputs into parts of at most BYTES (at least 64K)" << std::endl
+              << "  --conductor  Put track 1's tempo, time and key signatures in front of every other track" << std::endl
+              << "  --merge OUT.mid  Merge all tracks of the given input files into one Format 0 file" << std::endl
+              << "  -o, --output DIR Split every input file (or the MIDI files in an input directory) into DIR" << std::endl
+              << "  --watch DIR  Keep running and split every MIDI file written into DIR (Linux)" << std::endl
+              << "  --help       Show this help" << std::endl;
+}
+
+} // namespace midisplitter::detail
+
+using namespace midisplitter::detail;
+
+int main(int argc, char* argv[]) {
+    // The JSON of --inspect goes to stdout on its own
+    bool inspect = std::find(argv + 1, argv + argc, std::string("--inspect")) != argv + argc;
+    if (!inspect) {
+        std::cout << "MIDI Splitter C++ v1.0" << std::endl;
+        std::cout << "======================" << std::endl << std::endl;
+    }
+
+    SplitOptions options;
+    std::vector<std::string> paths;
+    bool stats = false;
+    bool jobsGiven = false;
+    std::string mergeOutput;
+    std::string batchOutput;
+    std::string watchDir;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i == 1 && arg == "split" && !fs::exists(arg)) {
+            continue; // "midisplitter2 split a.mid b.mid -o out/"
+        } else if (arg == "--reflink") {
+            options.reflinkAligned = true;
+        } else if (arg == "--io-uring") {
+            options.ioUring = true;
+        } else if (arg == "--cache-window" && i + 1 < argc) {
+            try {
+                uint64_t megabytes = parseCount(argv[++i], std::numeric_limits<size_t>::max() >> 20);
+                if (megabytes == 0) throw std::invalid_argument(argv[i]);
+                options.cacheWindow = static_cast<size_t>(megabytes) << 20;
+            } catch (const std::exception&) {
+                std::cerr << "Invalid value for " << arg << ": " << argv[i] << " (expected a whole number of megabytes, at least 1)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--direct") {
+            options.directIO = true;
+        } else if (arg == "--index") {
+            options.useIndex = true;
+        } else if (arg == "--conductor") {
+            options.embedConductor = true;
+        } else if (arg == "--stream") {
+            options.singlePass = true;
+        } else if ((arg == "--jobs" || arg == "-j") && i + 1 < argc) {
+            try {
+                options.jobs = static_cast<unsigned>(parseCount(argv[++i], std::numeric_limits<unsigned>::max()));
+                jobsGiven = true;
+            } catch (const std::exception&) {
+                std::cerr << "Invalid value for " << arg << ": " << argv[i] << " (expected a whole number, 0 for one per CPU core)" << std::endl;
+                return 1;
+            }
+        } else if ((arg == "--tracks" || arg == "--name-regex" || arg == "--min-size" || arg == "--max-size" ||
+                    arg == "--max-part-size") && i + 1 < argc) {
+            std::string value = argv[++i];
+            try {
+                if (arg == "--tracks") {
+                    auto ranges = parseTrackRanges(value);
+                    options.trackRanges.insert(options.trackRanges.end(), ranges.begin(), ranges.end());
+                } else if (arg == "--name-regex") {
+                    std::regex check(value); // Reject bad patterns before any work is done
+                    options.nameRegex = value;
+                } else if (arg == "--max-part-size") {
+                    // Room for the headers, a few events and the notes closed at each cut
+                    options.maxPartSize = parseByteSize(value);
+                    if (options.maxPartSize < 64 << 10) throw std::invalid_argument(value);
+                } else if (arg == "--min-size") {
+                    options.minSize = parseByteSize(value);
+                } else {
+                    options.maxSize = parseByteSize(value);
                 }
+            } catch (const std::exception&) {
+                std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--merge" && i + 1 < argc) {
+            mergeOutput = argv[++i];
+        } else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+            batchOutput = argv[++i];
+        } else if (arg == "--watch" && i + 1 < argc) {
+            watchDir = argv[++i];
+        } else if (arg == "--inspect") {
+            // Handled after the arguments are parsed
+        } else if (arg == "--bench-search") {
+            try {
+                benchmarkNameSearch();
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
             }
+            return 0;
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
 
-            splitMIDIFile(inputFile, outputDir);
+    if (!mergeOutput.empty()) {
+        if (paths.empty()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        try {
+            MIDISplitter().mergeMIDIFiles(paths, mergeOutput);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
+    if ((paths.size() > 2 && batchOutput.empty()) || ((inspect || stats) && paths.size() != 1)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (stats) {
+        // Decoding is CPU bound, so use every core unless told otherwise
+        if (!jobsGiven) options.jobs = 0;
+        try {
+            MIDISplitter().statsMIDIFile(paths[0], options);
         } catch (const std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
         }
+        return 0;
+    }
 
-#ifdef _WIN32
-        CoUninitialize();
+    if (inspect) {
+        try {
+            // Notes about recovered tracks go to stderr, away from the JSON
+            MIDISplitter(std::cerr).inspectMIDIFile(paths[0], std::cout);
+        } catch (const std::exception& e) {
+            std::cout.flush();
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+#ifndef __linux__
+    if (options.reflinkAligned) {
+        std::cout << "Note: --reflink is only supported on Linux, copying normally." << std::endl;
+        options.reflinkAligned = false;
+    }
 #endif
 
-        std::cout << "\nPress Enter to exit...";
-        std::cin.get();
+    if (!watchDir.empty()) {
+        if (batchOutput.empty() || !paths.empty()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        try {
+            fs::create_directories(batchOutput);
+            if (!jobsGiven) options.jobs = 0;
+            BatchSplitter().watchDirectory(watchDir, batchOutput, options);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
     }
-};
 
-int main() {
-    std::cout << "MIDI Splitter C++ v1.0" << std::endl;
-    std::cout << "======================" << std::endl << std::endl;
+    if (!batchOutput.empty()) {
+        // Directories stand for the MIDI files directly inside them
+        std::vector<std::string> inputs;
+        try {
+            for (const auto& path : paths) {
+                if (!fs::is_directory(path)) {
+                    inputs.push_back(path);
+                    continue;
+                }
+                std::vector<std::string> found;
+                for (const auto& entry : fs::directory_iterator(path)) {
+                    if (entry.is_regular_file() && hasMidiExtension(entry.path())) {
+                        found.push_back(entry.path().string());
+                    }
+                }
+                std::sort(found.begin(), found.end());
+                inputs.insert(inputs.end(), found.begin(), found.end());
+            }
+            if (inputs.empty()) {
+                std::cerr << "Error: no input files" << std::endl;
+                return 1;
+            }
+            fs::create_directories(batchOutput);
 
-    MIDISplitter splitter;
-    splitter.run();
+            // Splitting is spread over the files and their tracks, so use every core unless told otherwise
+            if (!jobsGiven) options.jobs = 0;
+            return BatchSplitter().splitBatch(inputs, batchOutput, options) == 0 ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return run(options, paths.size() > 0 ? paths[0] : "", paths.size() > 1 ? paths[1] : "");
+}
@@ -0,0 +1,2324 @@
+// Definitions of the MIDISplitter members declared in midisplitter_core.h
+#include "midisplitter_core.h"
+
+namespace midisplitter::detail {
+
+uint32_t MIDISplitter::bytesToUInt32(std::span<const uint8_t> bytes, size_t offset) {
+    if (offset + 4 > bytes.size()) return 0;
+    return (static_cast<uint32_t>(bytes[offset]) << 24) |
+           (static_cast<uint32_t>(bytes[offset + 1]) << 16) |
+           (static_cast<uint32_t>(bytes[offset + 2]) << 8) |
+           static_cast<uint32_t>(bytes[offset + 3]);
+}
+
+uint16_t MIDISplitter::bytesToUInt16(std::span<const uint8_t> bytes, size_t offset) {
+    if (offset + 2 > bytes.size()) return 0;
+    return (static_cast<uint16_t>(bytes[offset]) << 8) |
+           static_cast<uint16_t>(bytes[offset + 1]);
+}
+
+uint64_t MIDISplitter::bytesToUInt64(std::span<const uint8_t> bytes, size_t offset) {
+    if (offset + 8 > bytes.size()) return 0;
+    return (static_cast<uint64_t>(bytesToUInt32(bytes, offset)) << 32) | bytesToUInt32(bytes, offset + 4);
+}
+
+std::vector<uint8_t> MIDISplitter::uint64ToBytes(uint64_t value) {
+    auto bytes = uint32ToBytes(static_cast<uint32_t>(value >> 32));
+    auto low = uint32ToBytes(static_cast<uint32_t>(value));
+    bytes.insert(bytes.end(), low.begin(), low.end());
+    return bytes;
+}
+
+std::vector<uint8_t> MIDISplitter::uint32ToBytes(uint32_t value) {
+    return {
+        static_cast<uint8_t>((value >> 24) & 0xFF),
+        static_cast<uint8_t>((value >> 16) & 0xFF),
+        static_cast<uint8_t>((value >> 8) & 0xFF),
+        static_cast<uint8_t>(value & 0xFF)
+    };
+}
+
+std::vector<uint8_t> MIDISplitter::uint16ToBytes(uint16_t value) {
+    return {
+        static_cast<uint8_t>((value >> 8) & 0xFF),
+        static_cast<uint8_t>(value & 0xFF)
+    };
+}
+
+size_t MIDISplitter::locateNameMeta(std::span<const uint8_t> window) {
+    size_t instrumentName = window.size();
+    for (size_t pos = findNameMeta(window.data(), window.size(), 0); pos < window.size();
+         pos = findNameMeta(window.data(), window.size(), pos + 1)) {
+        size_t nameIndex = pos + 2; // Skip the meta event bytes
+        if (nameIndex + 1 >= window.size()) break;
+        uint8_t nameLength = window[nameIndex];
+        if (nameLength == 0 || nameIndex + 1 + nameLength > window.size()) continue;
+        if (window[pos + 1] == 0x03) return pos;
+        if (instrumentName == window.size()) instrumentName = pos;
+    }
+    return instrumentName;
+}
+
+std::string MIDISplitter::extractTrackName(std::span<const uint8_t> trackData, uint16_t trackNumber) {
+    auto searchBuffer = trackData.first(std::min(trackData.size(), NAME_SEARCH_WINDOW));
+
+    size_t pos = locateNameMeta(searchBuffer);
+    if (pos < searchBuffer.size()) {
+        auto name = searchBuffer.subspan(pos + 3, searchBuffer[pos + 2]);
+        return std::string(name.begin(), name.end());
+    }
+
+    return "Track " + std::to_string(trackNumber);
+}
+
+std::string MIDISplitter::getSafeFilename(const std::string& name) {
+    std::string safe = name;
+    std::string invalid = "<>:\"/\\|?*";
+    for (char c : invalid) {
+        std::replace(safe.begin(), safe.end(), c, '_');
+    }
+    return safe;
+}
+
+MIDISplitter::MIDIHeader MIDISplitter::parseHeader(std::span<const uint8_t> headerData) {
+    std::string header(headerData.begin(), headerData.begin() + 4);
+    if (header != "MThd") {
+        throw std::runtime_error("Not a valid MIDI file (missing MThd header)");
+    }
+
+    uint32_t headerSize = bytesToUInt32(headerData, 4);
+    if (headerSize != 6) {
+        throw std::runtime_error("Invalid MIDI header size");
+    }
+
+    MIDIHeader result;
+    result.format = bytesToUInt16(headerData, 8);
+    if (result.format > 1) {
+        throw std::runtime_error("Not a Format 0 or Format 1 MIDI file");
+    }
+
+    result.trackCount = bytesToUInt16(headerData, 10);
+    result.division = bytesToUInt16(headerData, 12);
+    if (result.format == 0 && result.trackCount != 1) {
+        throw std::runtime_error("Format 0 MIDI file must have exactly one track");
+    }
+    return result;
+}
+
+uint32_t MIDISplitter::parseTrackHeader(std::span<const uint8_t> trackHeader, uint16_t trackNumber) {
+    std::string trackHeaderStr(trackHeader.begin(), trackHeader.begin() + 4);
+    if (trackHeaderStr != "MTrk") {
+        throw std::runtime_error("Invalid track header for track " + std::to_string(trackNumber));
+    }
+    return bytesToUInt32(trackHeader, 4);
+}
+
+std::vector<uint8_t> MIDISplitter::buildOutputHeader(uint16_t division, std::span<const uint8_t> conductor) {
+    std::vector<uint8_t> outputHeader;
+    outputHeader.reserve(14 + conductor.size());
+    
+    // MThd header
+    outputHeader.insert(outputHeader.end(), {'M', 'T', 'h', 'd'});
+    
+    // Header size (6 bytes)
+    auto headerSizeBytes = uint32ToBytes(6);
+    outputHeader.insert(outputHeader.end(), headerSizeBytes.begin(), headerSizeBytes.end());
+    
+    // Format (1 = format 1 - single track)
+    auto formatBytes = uint16ToBytes(1);
+    outputHeader.insert(outputHeader.end(), formatBytes.begin(), formatBytes.end());
+    
+    // Number of tracks (1 - single track, 2 - conductor + track)
+    auto trackCountBytes = uint16ToBytes(conductor.empty() ? 1 : 2);
+    outputHeader.insert(outputHeader.end(), trackCountBytes.begin(), trackCountBytes.end());
+    
+    // Division (unchanged)
+    auto divisionBytes = uint16ToBytes(division);
+    outputHeader.insert(outputHeader.end(), divisionBytes.begin(), divisionBytes.end());
+
+    outputHeader.insert(outputHeader.end(), conductor.begin(), conductor.end());
+    return outputHeader;
+}
+
+std::vector<uint8_t> MIDISplitter::extractConductor(std::span<const uint8_t> trackData) {
+    std::vector<uint8_t> events;
+    uint64_t tick = 0;
+    uint64_t lastTick = 0;
+    uint8_t runningStatus = 0;
+    TrackEvent event;
+    for (size_t pos = 0; pos < trackData.size() && nextEvent(trackData, pos, runningStatus, event) == EventParse::Ok; pos = event.end) {
+        if (isEndOfTrack(event)) break;
+        tick += event.delta;
+        runningStatus = runningStatusAfter(event);
+        if (event.status == 0xFF && (event.metaType == 0x51 || event.metaType == 0x58 || event.metaType == 0x59)) {
+            appendDeltaTime(events, tick - lastTick);
+            events.insert(events.end(), trackData.begin() + event.body, trackData.begin() + event.end);
+            lastTick = tick;
+        }
+    }
+    if (events.empty()) return events;
+
+    events.insert(events.end(), {0x00, 0xFF, 0x2F, 0x00});
+    std::vector<uint8_t> chunk = {'M', 'T', 'r', 'k'};
+    auto size = uint32ToBytes(static_cast<uint32_t>(events.size()));
+    chunk.insert(chunk.end(), size.begin(), size.end());
+    chunk.insert(chunk.end(), events.begin(), events.end());
+    return chunk;
+}
+
+MIDISplitter::OutputHeaders MIDISplitter::buildOutputHeaders(uint16_t division, std::span<const uint8_t> firstTrack,
+                                                             const SplitOptions& options) {
+    OutputHeaders headers{buildOutputHeader(division), {}};
+    if (!options.embedConductor) return headers;
+
+    std::vector<uint8_t> conductor = extractConductor(firstTrack);
+    if (conductor.empty()) {
+        log_ << "Note: track 1 has no tempo, time signature or key signature events, no conductor embedded" << std::endl;
+        return headers;
+    }
+    headers.withConductor = buildOutputHeader(division, conductor);
+    log_ << "Embedding conductor track (" << conductor.size() - 8 << " bytes) from track 1" << std::endl;
+    return headers;
+}
+
+void MIDISplitter::walkEvents(std::span<const uint8_t> data, size_t limit, EventWalk& walk, SoundingNotes* notes) {
+    TrackEvent event;
+    while (walk.pos < data.size()) {
+        EventParse result = nextEvent(data, walk.pos, walk.runningStatus, event);
+        if (result != EventParse::Ok) {
+            walk.malformed = result == EventParse::Malformed;
+            break;
+        }
+
+        bool endOfTrack = isEndOfTrack(event);
+        const uint8_t* channelData = event.status < 0xF0 ? data.data() + event.data : nullptr;
+        size_t reserve = 0;
+        if (notes && !endOfTrack) {
+            uint32_t keys = notes->keys;
+            if (channelData) keys += notes->keyDelta(event.status, channelData);
+            reserve = keys * PART_CLOSE_BYTES_PER_KEY + END_OF_TRACK_BYTES;
+        }
+        if (event.end + reserve > limit) break;
+
+        if (notes && channelData) notes->apply(event.status, channelData);
+        walk.runningStatus = runningStatusAfter(event);
+        walk.ticks += event.delta;
+        walk.pos = event.end;
+        if (endOfTrack) {
+            walk.ended = true;
+            break;
+        }
+    }
+}
+
+size_t MIDISplitter::findEndOfTrack(std::span<const uint8_t> data) {
+    EventWalk walk;
+    walkEvents(data, data.size(), walk);
+    return walk.ended ? walk.pos : data.size() + 1;
+}
+
+MIDISplitter::TrackMetadata MIDISplitter::readTrackMetadata(std::span<const uint8_t> trackData) {
+    TrackMetadata meta;
+    TrackEvent event;
+    uint8_t runningStatus = 0;
+    for (size_t pos = 0; pos < trackData.size(); pos = event.end) {
+        // The lead-in ends at a non-zero delta-time, whether or not its event is complete
+        size_t deltaEnd = pos;
+        uint32_t delta;
+        EventParse result = readVarLen(trackData, deltaEnd, delta);
+        if (result == EventParse::Ok && delta != 0) return meta;
+        if (result == EventParse::Ok) result = nextEvent(trackData, pos, runningStatus, event);
+        if (result == EventParse::Truncated) break;
+        if (result == EventParse::Malformed) {
+            meta.malformed = true;
+            return meta;
+        }
+
+        if (event.status == 0xFF) {
+            auto payload = trackData.subspan(event.data, event.end - event.data);
+            if (event.metaType == 0x03 && meta.name.empty()) {
+                meta.name.assign(payload.begin(), payload.end());
+            } else if (event.metaType == 0x04 && meta.instrument.empty()) {
+                meta.instrument.assign(payload.begin(), payload.end());
+            } else if (event.metaType == 0x2F) {
+                return meta; // End of Track
+            }
+        } else if (event.status < 0xF0) {
+            if ((event.status & 0xF0) == 0xC0 && meta.program < 0) {
+                meta.program = trackData[event.data];
+            }
+            meta.channels |= static_cast<uint16_t>(1u << (event.status & 0x0F));
+        }
+        runningStatus = runningStatusAfter(event);
+    }
+
+    meta.truncated = true;
+    return meta;
+}
+
+void MIDISplitter::describeTrack(TrackInfo& track, const TrackMetadata& meta, std::span<const uint8_t> trackData) {
+    track.instrument = meta.instrument;
+    track.program = meta.program;
+    track.channels = meta.channels;
+    if (!meta.name.empty()) {
+        track.name = meta.name;
+    } else if (!meta.instrument.empty()) {
+        track.name = meta.instrument;
+    } else if (meta.malformed) {
+        track.name = extractTrackName(trackData, track.number);
+    } else {
+        track.name = "Track " + std::to_string(track.number);
+    }
+}
+
+void MIDISplitter::printTrackInfo(const TrackInfo& track) {
+    if (track.number == 1) {
+        log_ << "Primary Track: " << track.name << " (" << track.size << " bytes)" << std::endl;
+    } else {
+        log_ << "Track " << track.number << ": " << track.name << " (" << track.size << " bytes)" << std::endl;
+    }
+
+    if (!track.instrument.empty() && track.instrument != track.name) {
+        log_ << "  Instrument: " << track.instrument << std::endl;
+    }
+    if (track.program >= 0) {
+        log_ << "  Program: " << track.program << std::endl;
+    }
+    if (track.channels) {
+        log_ << "  Channels:";
+        for (int channel = 0; channel < 16; channel++) {
+            if (track.channels & (1u << channel)) log_ << " " << channel + 1;
+        }
+        log_ << std::endl;
+    }
+}
+
+fs::path MIDISplitter::makeOutputPath(const std::string& outputDir, const std::string& baseName,
+                                      const std::string& trackName, const std::set<fs::path>& taken, uint64_t parts,
+                                      const std::set<fs::path>& partOwners) {
+    std::string safeTrackName = getSafeFilename(trackName);
+    fs::path outputPath = fs::path(outputDir) / (baseName + " - " + safeTrackName + ".mid");
+
+    int counter = 1;
+    while (taken.count(outputPath) || fs::exists(outputPath) ||
+           (parts > 0 && partPathsInUse(outputPath, parts, taken, partOwners))) {
+        outputPath = fs::path(outputDir) / (baseName + " - " + safeTrackName + " (Copy " + std::to_string(counter) + ").mid");
+        counter++;
+    }
+    return outputPath;
+}
+
+void MIDISplitter::checkFreeSpace(const std::string& outputDir, uint64_t requiredBytes, size_t fileCount) {
+    std::error_code error;
+    fs::space_info space = fs::space(outputDir, error);
+    if (error) return; // Unknown; the writes will report it if space runs out
+
+    // Every file also rounds up to a whole filesystem block
+    const uint64_t ALLOCATION_UNIT = 4096;
+    requiredBytes += fileCount * ALLOCATION_UNIT;
+    if (space.available < requiredBytes) {
+        throw std::runtime_error("Not enough free space in " + outputDir + ": the split needs " +
+                                 std::to_string(requiredBytes) + " bytes but only " +
+                                 std::to_string(space.available) + " are available");
+    }
+}
+
+std::set<fs::path> MIDISplitter::partFileOwners(const std::string& outputDir) {
+    const std::string marker = " (part ";
+    std::set<fs::path> owners;
+    std::error_code error;
+    for (fs::directory_iterator entry(outputDir.empty() ? fs::path(".") : fs::path(outputDir), error), end;
+         !error && entry != end; entry.increment(error)) {
+        std::string name = entry->path().filename().string();
+        std::string extension = entry->path().extension().string();
+        size_t pos = name.rfind(marker);
+        if (pos != std::string::npos && name.size() > pos + marker.size() + 1 + extension.size() &&
+            name.ends_with(")" + extension)) {
+            owners.insert(fs::path(outputDir) / (name.substr(0, pos) + extension));
+        }
+    }
+    return owners;
+}
+
+bool MIDISplitter::partPathsInUse(const fs::path& outputPath, uint64_t parts, const std::set<fs::path>& taken,
+                                  const std::set<fs::path>& partOwners) {
+    for (uint64_t part = 1; part <= parts; part++) {
+        if (taken.count(makePartPath(outputPath, static_cast<unsigned>(part)))) return true;
+    }
+    return partOwners.count(outputPath) > 0;
+}
+
+std::vector<fs::path> MIDISplitter::planOutputPaths(const std::string& outputDir, const std::string& baseName,
+                                                    const std::vector<TrackInfo>& tracks, const OutputHeaders& headers,
+                                                    const SplitOptions& options, std::vector<fs::path>& partPaths,
+                                                    PlannedOutputs* planned) {
+    std::unique_lock<std::mutex> lock;
+    std::set<fs::path> ownPaths;
+    std::set<fs::path>& taken = planned ? planned->paths : ownPaths;
+    if (planned) {
+        lock = std::unique_lock<std::mutex>(planned->mutex);
+    }
+
+    std::vector<fs::path> outputPaths;
+    outputPaths.reserve(tracks.size());
+    std::set<fs::path> partOwners; // Listed when the first track to be cut needs it
+    bool partsListed = false;
+    for (const auto& track : tracks) {
+        uint64_t parts = expectedPartCount(track, headers.forTrack(track), options);
+        if (parts > 0 && !partsListed) {
+            partOwners = partFileOwners(outputDir);
+            partsListed = true;
+        }
+        outputPaths.push_back(makeOutputPath(outputDir, baseName, track.name, taken, parts, partOwners));
+        taken.insert(outputPaths.back());
+        for (uint64_t part = 1; part <= parts; part++) {
+            partPaths.push_back(makePartPath(outputPaths.back(), static_cast<unsigned>(part)));
+            taken.insert(partPaths.back());
+        }
+    }
+    return outputPaths;
+}
+
+size_t MIDISplitter::chooseBufferSize(uint64_t size, size_t cacheWindow) {
+    const size_t MIN_BUFFER_SIZE = 64 << 10;
+    const size_t MAX_BUFFER_SIZE = 4 << 20;
+    size_t bufferSize = static_cast<size_t>(std::clamp<uint64_t>(size / 16, MIN_BUFFER_SIZE, MAX_BUFFER_SIZE));
+    if (cacheWindow > 0) {
+        bufferSize = std::min(bufferSize, cacheWindow);
+    }
+    return bufferSize;
+}
+
+void MIDISplitter::copyStream(std::istream& in, OutputFile& out, size_t size, std::vector<char>& buffer,
+                              PageCacheWindow* window) {
+    while (size > 0) {
+        size_t bytesToRead = std::min(size, buffer.size());
+        in.read(buffer.data(), static_cast<std::streamsize>(bytesToRead));
+        if (in.gcount() == 0) break; // No more data to read
+        
+        out.write(reinterpret_cast<const uint8_t*>(buffer.data()), static_cast<size_t>(in.gcount()));
+        if (window != nullptr) {
+            window->advance(static_cast<size_t>(in.gcount()));
+        }
+        
+        size -= static_cast<size_t>(in.gcount());
+        if (in.eof()) break; // Reached end of file
+    }
+}
+
+size_t MIDISplitter::trackByteCount(const MappedFile& input, const TrackInfo& track) {
+    if (track.position >= input.size()) return 0;
+    return static_cast<size_t>(std::min<uint64_t>(8 + static_cast<uint64_t>(track.size), input.size() - track.position));
+}
+
+fs::path MIDISplitter::makePartPath(const fs::path& outputPath, unsigned part) {
+    fs::path partPath = outputPath;
+    partPath.replace_filename(outputPath.stem().string() + " (part " + std::to_string(part) + ")" +
+                              outputPath.extension().string());
+    return partPath;
+}
+
+void MIDISplitter::appendDeltaTime(std::vector<uint8_t>& out, uint64_t ticks) {
+    const uint32_t MAX_DELTA = 0x0FFFFFFF;
+    for (; ticks > MAX_DELTA; ticks -= MAX_DELTA) {
+        out.insert(out.end(), {0xFF, 0xFF, 0xFF, 0x7F, 0xFF, 0x01, 0x00});
+    }
+    uint8_t bytes[4];
+    int count = 0;
+    do {
+        bytes[count++] = static_cast<uint8_t>(ticks & 0x7F);
+        ticks >>= 7;
+    } while (ticks > 0);
+    while (count > 1) {
+        out.push_back(bytes[--count] | 0x80);
+    }
+    out.push_back(bytes[0]);
+}
+
+void MIDISplitter::writeChunkHeader(OutputFile& out, uint64_t size) {
+    std::vector<uint8_t> header = {'M', 'T', 'r', 'k'};
+    auto sizeBytes = uint32ToBytes(static_cast<uint32_t>(size));
+    header.insert(header.end(), sizeBytes.begin(), sizeBytes.end());
+    out.write(header.data(), header.size());
+}
+
+uint64_t MIDISplitter::maxChunkSize(const std::vector<uint8_t>& outputHeader, const SplitOptions& options) {
+    uint64_t limit = MAX_MTRK_SIZE;
+    if (options.maxPartSize > 0) {
+        limit = std::min(limit, options.maxPartSize - std::min<uint64_t>(options.maxPartSize, outputHeader.size() + 8));
+    }
+    return limit;
+}
+
+void MIDISplitter::appendPartNames(std::vector<uint8_t>& out, const TrackMetadata& meta) {
+    for (auto [type, text] : {std::pair<uint8_t, const std::string*>{0x03, &meta.name}, {0x04, &meta.instrument}}) {
+        if (text->empty()) continue;
+        out.insert(out.end(), {0x00, 0xFF, type});
+        appendDeltaTime(out, text->size()); // Meta lengths are VLQs as well
+        out.insert(out.end(), text->begin(), text->end());
+    }
+}
+
+void MIDISplitter::appendChannelState(std::vector<uint8_t>& out, const SoundingNotes& notes, uint64_t& delta) {
+    std::vector<size_t> slots;
+    for (size_t slot = 0; slot < notes.order.size(); slot++) {
+        if (notes.order[slot] != 0) slots.push_back(slot);
+    }
+    std::sort(slots.begin(), slots.end(), [&notes](size_t a, size_t b) { return notes.order[a] < notes.order[b]; });
+
+    for (size_t slot : slots) {
+        uint8_t channel = static_cast<uint8_t>(slot / SoundingNotes::STATE_SLOTS);
+        size_t kind = slot % SoundingNotes::STATE_SLOTS;
+        const auto& data = notes.value[slot];
+        appendDeltaTime(out, delta);
+        delta = 0;
+        if (kind == SoundingNotes::PROGRAM_SLOT) {
+            out.insert(out.end(), {static_cast<uint8_t>(0xC0 | channel), data[0]});
+        } else if (kind == SoundingNotes::PITCH_BEND_SLOT) {
+            out.insert(out.end(), {static_cast<uint8_t>(0xE0 | channel), data[0], data[1]});
+        } else {
+            out.insert(out.end(), {static_cast<uint8_t>(0xB0 | channel), data[0], data[1]});
+        }
+    }
+}
+
+bool MIDISplitter::needsRewrite(const TrackInfo& track, const std::vector<uint8_t>& outputHeader,
+                                const SplitOptions& options) {
+    return track.recovered() || track.size > maxChunkSize(outputHeader, options);
+}
+
+uint64_t MIDISplitter::expectedPartCount(const TrackInfo& track, const std::vector<uint8_t>& outputHeader,
+                                         const SplitOptions& options) {
+    uint64_t chunkLimit = maxChunkSize(outputHeader, options);
+    if (track.size <= chunkLimit || chunkLimit == 0) return 0;
+    return (track.size + chunkLimit - 1) / chunkLimit;
+}
+
+unsigned MIDISplitter::writeRewrittenTrack(const MappedFile& input, const fs::path& outputPath,
+                                           const std::vector<uint8_t>& outputHeader, const TrackInfo& track,
+                                           const SplitOptions& options) {
+    size_t available = trackByteCount(input, track);
+    std::span<const uint8_t> trackData = input.bytes().subspan(static_cast<size_t>(track.position) + 8,
+                                                               available > 8 ? available - 8 : 0);
+    input.adviseSequential(track.position + 8, trackData.size());
+
+    uint64_t chunkLimit = maxChunkSize(outputHeader, options);
+    if (trackData.size() <= chunkLimit) {
+        OutputFile out(outputPath);
+        out.preallocate(outputHeader.size() + 8 + trackData.size());
+        out.write(outputHeader.data(), outputHeader.size());
+        writeChunkHeader(out, trackData.size());
+        out.write(trackData.data(), trackData.size());
+        out.close();
+        return 0;
+    }
+
+    auto cutError = [&track](const std::string& reason) {
+        return std::runtime_error("Cannot cut track " + std::to_string(track.number) + " into parts: " + reason);
+    };
+
+    // Names at the start of the track, repeated in every part
+    TrackMetadata meta = readTrackMetadata(trackData.first(static_cast<size_t>(std::min<uint64_t>(trackData.size(), MAX_METADATA_SCAN))));
+
+    SoundingNotes notes;
+    TrackEvent event;
+    uint8_t runningStatus = 0;
+    uint64_t tick = 0;
+    size_t pos = 0;
+    unsigned parts = 0;
+    // The part being written removes itself when it fails; the ones before it are removed here,
+    // so a track is either written in full or not at all
+    try {
+        for (unsigned part = 1; pos < trackData.size(); part++) {
+            if (nextEvent(trackData, pos, runningStatus, event) != EventParse::Ok) {
+                throw cutError("malformed event at offset " + std::to_string(pos));
+            }
+
+            // Parts after the first start with the track and instrument names. At the time of the
+            // cut they restore the controllers, programs and pitch bends in effect, then reopen the
+            // notes cut off at the end of the previous part. The first event follows at its own
+            // delta-time.
+            std::vector<uint8_t> prefix;
+            uint64_t pendingDelta = tick;
+            if (part > 1) {
+                appendPartNames(prefix, meta);
+                appendChannelState(prefix, notes, pendingDelta);
+            }
+            for (size_t slot = 0; notes.keys > 0 && slot < notes.count.size(); slot++) {
+                if (notes.count[slot] == 0) continue;
+                appendDeltaTime(prefix, pendingDelta);
+                prefix.insert(prefix.end(), {static_cast<uint8_t>(0x90 | (slot / 128)), static_cast<uint8_t>(slot % 128),
+                                             notes.velocity[slot]});
+                pendingDelta = 0;
+            }
+            appendDeltaTime(prefix, pendingDelta + event.delta);
+            if (event.runningStatus) {
+                prefix.push_back(event.status);
+            }
+            tick += event.delta;
+
+            size_t bodyStart = event.body;
+            if (prefix.size() >= chunkLimit) {
+                throw cutError("too many notes and controllers to restore at a cut for the part size");
+            }
+            size_t budget = static_cast<size_t>(chunkLimit) - prefix.size();
+
+            // The first event always goes in; it must leave room to close the part
+            if (event.status < 0xF0) {
+                notes.apply(event.status, trackData.data() + event.data);
+            }
+            EventWalk walk;
+            walk.pos = event.end;
+            walk.runningStatus = runningStatusAfter(event);
+            walk.ended = isEndOfTrack(event);
+            size_t closing = walk.ended ? 0 : notes.keys * PART_CLOSE_BYTES_PER_KEY + END_OF_TRACK_BYTES;
+            if (event.end - bodyStart + closing > budget) {
+                throw cutError("event at offset " + std::to_string(pos) + " does not fit in a part");
+            }
+
+            // Take whole events while they and the closing events fit
+            if (!walk.ended) {
+                walkEvents(trackData, bodyStart + budget, walk, &notes);
+            }
+            if (walk.malformed) {
+                throw cutError("malformed event at offset " + std::to_string(walk.pos));
+            }
+            tick += walk.ticks;
+            size_t bodyEnd = walk.pos;
+            runningStatus = walk.runningStatus;
+
+            // Close the part: note-offs for whatever still sounds, then End of Track
+            std::vector<uint8_t> suffix;
+            if (!walk.ended) {
+                for (size_t slot = 0; slot < notes.count.size(); slot++) {
+                    if (notes.count[slot] == 0) continue;
+                    suffix.insert(suffix.end(), {0x00, static_cast<uint8_t>(0x80 | (slot / 128)), static_cast<uint8_t>(slot % 128), 0x40});
+                }
+                suffix.insert(suffix.end(), {0x00, 0xFF, 0x2F, 0x00});
+            }
+
+            uint64_t chunkSize = prefix.size() + (bodyEnd - bodyStart) + suffix.size();
+            fs::path partPath = makePartPath(outputPath, part);
+            OutputFile out(partPath);
+            out.preallocate(outputHeader.size() + 8 + chunkSize);
+            out.write(outputHeader.data(), outputHeader.size());
+            writeChunkHeader(out, chunkSize);
+            out.write(prefix.data(), prefix.size());
+            out.write(trackData.data() + bodyStart, bodyEnd - bodyStart);
+            out.write(suffix.data(), suffix.size());
+            out.close();
+            parts = part;
+
+            pos = bodyEnd;
+            if (walk.ended) break; // Anything after End of Track is not part of the track
+        }
+    } catch (...) {
+        for (unsigned part = 1; part <= parts; part++) {
+            std::error_code error;
+            fs::remove(makePartPath(outputPath, part), error);
+        }
+        throw;
+    }
+    return parts;
+}
+
+#ifdef __linux__
+void MIDISplitter::copyFileRange(const MappedFile& input, int outFd, uint64_t offset, size_t size) {
+    off_t inOffset = static_cast<off_t>(offset);
+
+    while (size > 0) {
+        ssize_t copied = ::copy_file_range(input.fd(), &inOffset, outFd, nullptr, size, 0);
+        if (copied < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                           errno == EOPNOTSUPP || errno == EBADF)) {
+            break; // Not supported for this pair of files
+        }
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Error copying track data: ") + std::strerror(errno));
+        }
+        if (copied == 0) return; // Reached end of file
+        size -= static_cast<size_t>(copied);
+    }
+
+    while (size > 0) {
+        ssize_t copied = ::sendfile(outFd, input.fd(), &inOffset, size);
+        if (copied < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            break;
+        }
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Error copying track data: ") + std::strerror(errno));
+        }
+        if (copied == 0) return; // Reached end of file
+        size -= static_cast<size_t>(copied);
+    }
+
+    if (size > 0) {
+        auto source = input.bytes().subspan(static_cast<size_t>(inOffset), size);
+        input.adviseSequential(static_cast<uint64_t>(inOffset), size);
+        writeAll(outFd, source.data(), source.size());
+    }
+}
+
+std::vector<uint8_t> MIDISplitter::makePaddingChunk(size_t payloadSize) {
+    std::vector<uint8_t> chunk = {'X', 'P', 'A', 'D'};
+    auto sizeBytes = uint32ToBytes(static_cast<uint32_t>(payloadSize));
+    chunk.insert(chunk.end(), sizeBytes.begin(), sizeBytes.end());
+    chunk.resize(chunk.size() + payloadSize, 0);
+    return chunk;
+}
+
+std::optional<std::pair<dev_t, dev_t>> MIDISplitter::cloneDevices(const MappedFile& input, int outFd) {
+    struct stat inInfo, outInfo;
+    if (::fstat(input.fd(), &inInfo) != 0 || ::fstat(outFd, &outInfo) != 0) return std::nullopt;
+    return std::make_pair(inInfo.st_dev, outInfo.st_dev);
+}
+
+bool MIDISplitter::cloneSupported(const MappedFile& input, int outFd, off_t sourceOffset, size_t blockSize) {
+    auto devices = cloneDevices(input, outFd);
+    if (!devices) return false;
+
+    std::lock_guard<std::mutex> lock(cloneProbeMutex);
+    auto known = cloneProbes.find(*devices);
+    if (known != cloneProbes.end()) return known->second;
+
+    file_clone_range range;
+    range.src_fd = input.fd();
+    range.src_offset = static_cast<uint64_t>(sourceOffset);
+    range.src_length = blockSize;
+    range.dest_offset = 0;
+    bool supported = ::ioctl(outFd, FICLONERANGE, &range) == 0;
+    if (supported && ::ftruncate(outFd, 0) != 0) {
+        throw std::runtime_error(std::string("Error sizing output file: ") + std::strerror(errno));
+    }
+    cloneProbes.emplace(*devices, supported);
+    return supported;
+}
+
+void MIDISplitter::markCloneRefused(const MappedFile& input, int outFd) {
+    auto devices = cloneDevices(input, outFd);
+    if (!devices) return;
+    std::lock_guard<std::mutex> lock(cloneProbeMutex);
+    cloneProbes[*devices] = false;
+}
+
+bool MIDISplitter::cloneFileRange(const MappedFile& input, int outFd, off_t offset, size_t size, size_t blockSize) {
+    off_t end = offset + static_cast<off_t>(size);
+    off_t alignedStart = (offset + static_cast<off_t>(blockSize) - 1) / static_cast<off_t>(blockSize) * static_cast<off_t>(blockSize);
+    off_t alignedEnd = end / static_cast<off_t>(blockSize) * static_cast<off_t>(blockSize);
+    if (alignedEnd <= alignedStart) {
+        copyFileRange(input, outFd, offset, size);
+        return true;
+    }
+
+    off_t outStart = ::lseek(outFd, 0, SEEK_CUR);
+    if (outStart < 0) return false;
+
+    // Head: the partial block before the first source block boundary
+    copyFileRange(input, outFd, offset, static_cast<size_t>(alignedStart - offset));
+
+    file_clone_range range;
+    range.src_fd = input.fd();
+    range.src_offset = static_cast<uint64_t>(alignedStart);
+    range.src_length = static_cast<uint64_t>(alignedEnd - alignedStart);
+    range.dest_offset = static_cast<uint64_t>(outStart + (alignedStart - offset));
+    if (::ioctl(outFd, FICLONERANGE, &range) != 0) {
+        return false; // The caller starts the output over as a plain copy
+    }
+
+    // Tail: the partial block after the last source block boundary
+    if (::lseek(outFd, outStart + (alignedEnd - offset), SEEK_SET) < 0) {
+        throw std::runtime_error(std::string("Error seeking in output file: ") + std::strerror(errno));
+    }
+    copyFileRange(input, outFd, alignedEnd, static_cast<size_t>(end - alignedEnd));
+    return true;
+}
+
+void MIDISplitter::pwriteAll(int fd, const uint8_t* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Error writing to output file: ") + std::strerror(errno));
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += written;
+    }
+}
+
+bool MIDISplitter::writeTrackFileDirect(const MappedFile& input, const fs::path& outputPath,
+                                        const std::vector<uint8_t>& outputHeader, const TrackInfo& track) {
+    FileDescriptor outFd(::open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644));
+    if (!outFd) {
+        if (errno == EINVAL) return false;
+        throw std::runtime_error("Cannot create output file: " + outputPath.string());
+    }
+
+    size_t trackBytes = trackByteCount(input, track);
+    const uint8_t* source = input.bytes().data() + track.position;
+    input.adviseSequential(track.position, trackBytes);
+    preallocateOutput(outFd.get(), outputHeader.size() + trackBytes, outputPath);
+
+    AlignedBufferPool::Lease buffer = directBuffers.acquire();
+    size_t filled = outputHeader.size();
+    std::memcpy(buffer.data(), outputHeader.data(), filled);
+
+    uint64_t outputSize = outputHeader.size() + trackBytes;
+    off_t written = 0;
+    while (trackBytes > 0) {
+        size_t chunk = std::min(trackBytes, buffer.size() - filled);
+        std::memcpy(buffer.data() + filled, source, chunk);
+        source += chunk;
+        trackBytes -= chunk;
+        filled += chunk;
+
+        if (filled == buffer.size()) {
+            pwriteAll(outFd.get(), buffer.data(), filled, written);
+            written += static_cast<off_t>(filled);
+            filled = 0;
+        }
+    }
+
+    // Whole blocks of the last buffer still go direct
+    size_t alignedTail = filled / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    if (alignedTail > 0) {
+        pwriteAll(outFd.get(), buffer.data(), alignedTail, written);
+        written += static_cast<off_t>(alignedTail);
+    }
+
+    if (filled > alignedTail) {
+        int flags = ::fcntl(outFd.get(), F_GETFL);
+        if (flags < 0 || ::fcntl(outFd.get(), F_SETFL, flags & ~O_DIRECT) != 0) {
+            throw std::runtime_error(std::string("Cannot leave O_DIRECT mode: ") + std::strerror(errno));
+        }
+        pwriteAll(outFd.get(), buffer.data() + alignedTail, filled - alignedTail, written);
+    }
+
+    if (::ftruncate(outFd.get(), static_cast<off_t>(outputSize)) != 0) {
+        throw std::runtime_error(std::string("Error sizing output file: ") + std::strerror(errno));
+    }
+    if (::close(outFd.release()) != 0) {
+        throw std::runtime_error("Error closing output file: " + outputPath.string());
+    }
+    return true;
+}
+
+unsigned MIDISplitter::writeTrackFile(const MappedFile& input, const fs::path& outputPath,
+                                      const std::vector<uint8_t>& outputHeader, const TrackInfo& track,
+                                      const SplitOptions& options) {
+    if (needsRewrite(track, outputHeader, options)) {
+        return writeRewrittenTrack(input, outputPath, outputHeader, track, options);
+    }
+
+    // The header has to fit in the first aligned buffer
+    if (options.directIO && !options.reflinkAligned && outputHeader.size() < DIRECT_IO_BUFFER_SIZE) {
+        if (writeTrackFileDirect(input, outputPath, outputHeader, track)) return 0;
+        directRefused = true;
+    }
+
+    FileDescriptor outFd(::open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (!outFd) {
+        throw std::runtime_error("Cannot create output file: " + outputPath.string());
+    }
+
+    off_t trackOffset = static_cast<off_t>(track.position);
+    size_t trackBytes = trackByteCount(input, track);
+
+    // Outputs are only padded for cloning when the filesystems clone at all, so where they
+    // refuse the outputs come out exactly like a normal copy
+    size_t blockSize = 0;
+    if (options.reflinkAligned) {
+        struct statfs fsInfo;
+        if (::fstatfs(outFd.get(), &fsInfo) == 0 && fsInfo.f_bsize > 0) {
+            size_t fsBlockSize = static_cast<size_t>(fsInfo.f_bsize);
+
+            // Tracks that do not cover a whole block gain nothing from padding
+            size_t firstBlockOffset = (fsBlockSize - static_cast<size_t>(trackOffset) % fsBlockSize) % fsBlockSize;
+            if (firstBlockOffset + fsBlockSize <= trackBytes) {
+                if (cloneSupported(input, outFd.get(), trackOffset + static_cast<off_t>(firstBlockOffset), fsBlockSize)) {
+                    blockSize = fsBlockSize;
+                } else {
+                    reflinkRefused = true; // Reported after the split
+                }
+            }
+        }
+    }
+
+    // Cloned outputs share the source's blocks, so only copied ones are preallocated
+    if (blockSize == 0) {
+        preallocateOutput(outFd.get(), outputHeader.size() + trackBytes, outputPath);
+    }
+
+    // Write header (Format 1, single track)
+    writeAll(outFd.get(), outputHeader.data(), outputHeader.size());
+
+    bool copied = false;
+    if (blockSize > 0) {
+        size_t headerSize = outputHeader.size() + 8;
+        size_t padding = (static_cast<size_t>(trackOffset) % blockSize + blockSize - headerSize % blockSize) % blockSize;
+        auto paddingChunk = makePaddingChunk(padding);
+        writeAll(outFd.get(), paddingChunk.data(), paddingChunk.size());
+
+        copied = cloneFileRange(input, outFd.get(), trackOffset, trackBytes, blockSize);
+        if (!copied) {
+            // Refused although the probe succeeded (out of space for the shared extents, a
+            // range the filesystem will not share, ...): start the output over as a plain
+            // copy, so it does not keep the padding chunk
+            markCloneRefused(input, outFd.get());
+            reflinkRefused = true;
+            if (::ftruncate(outFd.get(), 0) != 0 || ::lseek(outFd.get(), 0, SEEK_SET) != 0) {
+                throw std::runtime_error(std::string("Error sizing output file: ") + std::strerror(errno));
+            }
+            preallocateOutput(outFd.get(), outputHeader.size() + trackBytes, outputPath);
+            writeAll(outFd.get(), outputHeader.data(), outputHeader.size());
+        }
+    }
+
+    if (!copied && options.cacheWindow > 0) {
+        // Copy window by window so the cache behind the cursor can be dropped as it goes
+        off_t outOffset = ::lseek(outFd.get(), 0, SEEK_CUR);
+        PageCacheWindow window(options.cacheWindow, input.fd(), static_cast<uint64_t>(trackOffset),
+                               outFd.get(), static_cast<uint64_t>(outOffset), &input);
+        while (trackBytes > 0) {
+            size_t chunk = std::min(trackBytes, options.cacheWindow);
+            copyFileRange(input, outFd.get(), static_cast<uint64_t>(trackOffset), chunk);
+            window.advance(chunk);
+            trackOffset += static_cast<off_t>(chunk);
+            trackBytes -= chunk;
+        }
+        window.finish();
+    } else if (!copied) {
+        // Write the track header and data (8 bytes header + track data) without leaving the kernel
+        copyFileRange(input, outFd.get(), static_cast<uint64_t>(trackOffset), trackBytes);
+    }
+
+    if (::close(outFd.release()) != 0) {
+        throw std::runtime_error("Error closing output file: " + outputPath.string());
+    }
+    return 0;
+}
+#else
+
+unsigned MIDISplitter::writeTrackFile(const MappedFile& input, const fs::path& outputPath,
+                                      const std::vector<uint8_t>& outputHeader, const TrackInfo& track,
+                                      const SplitOptions& options) {
+    if (needsRewrite(track, outputHeader, options)) {
+        return writeRewrittenTrack(input, outputPath, outputHeader, track, options);
+    }
+
+    std::ofstream outFile(outputPath, std::ios::binary);
+    if (!outFile) {
+        throw std::runtime_error("Cannot create output file: " + outputPath.string());
+    }
+
+    // Write header (Format 1, single track)
+    outFile.write(reinterpret_cast<const char*>(outputHeader.data()), outputHeader.size());
+    if (!outFile) {
+        throw std::runtime_error("Error writing header to: " + outputPath.string());
+    }
+
+    // Write ONLY this track (8 bytes header + track data) straight from the mapping
+    size_t trackBytes = trackByteCount(input, track);
+    input.adviseSequential(track.position, trackBytes);
+    outFile.write(reinterpret_cast<const char*>(input.bytes().data() + track.position), trackBytes);
+    if (!outFile) {
+        throw std::runtime_error("Error writing to output stream.");
+    }
+
+    outFile.close();
+    return 0;
+}
+#endif
+
+void MIDISplitter::printSplitResult(const TrackInfo& track, const fs::path& outputPath, unsigned parts) {
+    std::string trackType = (track.number == 1) ? "Tempo" : "Track";
+    log_ << "Splitting: " << trackType << " " << track.number << std::endl;
+    if (parts == 0) {
+        log_ << "  -> Created: " << outputPath.filename().string() << std::endl;
+    }
+    for (unsigned part = 1; part <= parts; part++) {
+        log_ << "  -> Created: " << makePartPath(outputPath, part).filename().string() << std::endl;
+    }
+}
+
+int MIDISplitter::writeTracksParallel(const MappedFile& input, const std::vector<TrackInfo>& tracks,
+                                      const std::vector<fs::path>& outputPaths, const OutputHeaders& headers,
+                                      const SplitOptions& options, unsigned jobs) {
+    enum class State { Pending, Written, Failed, Skipped };
+    std::vector<State> states(tracks.size(), State::Pending);
+    std::vector<unsigned> parts(tracks.size(), 0);
+    std::vector<std::exception_ptr> errors(tracks.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::atomic<size_t> nextTrack{0};
+    std::atomic<bool> failed{false};
+
+    auto worker = [&]() {
+        for (size_t index = nextTrack++; index < tracks.size(); index = nextTrack++) {
+            State state = State::Skipped;
+            if (!failed) {
+                try {
+                    parts[index] = writeTrackFile(input, outputPaths[index], headers.forTrack(tracks[index]), tracks[index], options);
+                    state = State::Written;
+                } catch (...) {
+                    errors[index] = std::current_exception();
+                    failed = true;
+                    state = State::Failed;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                states[index] = state;
+            }
+            finished.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(jobs);
+    for (unsigned i = 0; i < jobs; i++) {
+        workers.emplace_back(worker);
+    }
+
+    int splitCount = 0;
+    for (size_t index = 0; index < tracks.size(); index++) {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return states[index] != State::Pending; });
+        if (states[index] != State::Written) break;
+        lock.unlock();
+
+        printSplitResult(tracks[index], outputPaths[index], parts[index]);
+        splitCount++;
+    }
+
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    for (const auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+    return splitCount;
+}
+
+MIDISplitter::TrackStats MIDISplitter::decodeTrackStats(std::span<const uint8_t> trackData) {
+    TrackStats stats;
+    std::array<uint16_t, 16 * 128> sounding{}; // Per channel and key, overlapping notes stack
+    uint32_t polyphony = 0;
+    uint8_t runningStatus = 0;
+    TrackEvent event;
+    for (size_t pos = 0; pos < trackData.size(); pos = event.end) {
+        if (nextEvent(trackData, pos, runningStatus, event) != EventParse::Ok) {
+            stats.malformed = true;
+            break;
+        }
+        stats.ticks += event.delta;
+        stats.events++;
+        if (event.status < 0xF0) {
+            const uint8_t* p = trackData.data() + event.data;
+            unsigned channel = event.status & 0x0F;
+            stats.channels |= static_cast<uint16_t>(1u << channel);
+            uint8_t type = event.status & 0xF0;
+            if (type == 0x90 && p[1] != 0) {
+                stats.notes++;
+                sounding[channel * 128 + p[0]]++;
+                stats.maxPolyphony = std::max(stats.maxPolyphony, ++polyphony);
+            } else if ((type == 0x80 || type == 0x90) && sounding[channel * 128 + p[0]] > 0) {
+                sounding[channel * 128 + p[0]]--;
+                polyphony--;
+            }
+        } else if (isEndOfTrack(event)) {
+            break;
+        }
+        runningStatus = runningStatusAfter(event);
+    }
+    return stats;
+}
+
+std::vector<MIDISplitter::TrackStats> MIDISplitter::collectTrackStats(const MappedFile& input,
+                                                                      const std::vector<TrackInfo>& tracks,
+                                                                      unsigned jobs) {
+    std::vector<size_t> order(tracks.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&tracks](size_t a, size_t b) { return tracks[a].size > tracks[b].size; });
+
+    std::vector<TrackStats> stats(tracks.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < order.size(); i = next++) {
+            const TrackInfo& track = tracks[order[i]];
+            size_t length = trackByteCount(input, track);
+            if (length <= 8) continue;
+            input.adviseSequential(track.position + 8, length - 8);
+            stats[order[i]] = decodeTrackStats(input.bytes().subspan(static_cast<size_t>(track.position) + 8, length - 8));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < jobs; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    return stats;
+}
+
+bool MIDISplitter::trackSelected(const TrackInfo& track, const SplitOptions& options, const std::regex& nameRegex) {
+    if (!options.trackRanges.empty() &&
+        std::none_of(options.trackRanges.begin(), options.trackRanges.end(), [&track](const auto& range) {
+            return track.number >= range.first && track.number <= range.second;
+        })) {
+        return false;
+    }
+    if (track.size < options.minSize || track.size > options.maxSize) {
+        return false;
+    }
+    return options.nameRegex.empty() || std::regex_search(track.name, nameRegex);
+}
+
+void MIDISplitter::selectTracks(std::vector<TrackInfo>& tracks, const SplitOptions& options) {
+    if (!options.selectsTracks()) return;
+    size_t totalTracks = tracks.size();
+    std::regex nameRegex(options.nameRegex);
+    std::erase_if(tracks, [&](const TrackInfo& track) { return !trackSelected(track, options, nameRegex); });
+    log_ << "Selected " << tracks.size() << " of " << totalTracks << " tracks" << std::endl;
+}
+
+MIDISplitter::TrackMetadata MIDISplitter::readLeadIn(std::istream& in, uint32_t trackSize,
+                                                     std::vector<uint8_t>& leadIn) {
+    leadIn.clear();
+    size_t leadInLimit = std::min<size_t>(trackSize, MAX_METADATA_SCAN);
+    size_t wanted = std::min(leadInLimit, NAME_SEARCH_WINDOW);
+    while (true) {
+        size_t have = leadIn.size();
+        leadIn.resize(wanted);
+        in.read(reinterpret_cast<char*>(leadIn.data() + have), static_cast<std::streamsize>(wanted - have));
+        leadIn.resize(have + static_cast<size_t>(in.gcount()));
+        TrackMetadata meta = readTrackMetadata(leadIn);
+        if (!meta.truncated || leadIn.size() < wanted || wanted == leadInLimit) return meta;
+        wanted = std::min(leadInLimit, wanted * 4);
+    }
+}
+
+void MIDISplitter::skipStream(std::istream& in, uint64_t count) {
+    if (count == 0) return;
+    if (in.seekg(static_cast<std::streamoff>(count), std::ios::cur)) return;
+    in.clear();
+    while (count > 0 && in) {
+        auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(count, 1 << 20));
+        in.ignore(chunk);
+        count -= static_cast<uint64_t>(in.gcount());
+    }
+}
+
+std::string MIDISplitter::jsonString(const std::string& text) {
+    bool validUtf8 = true;
+    for (size_t i = 0; i < text.size() && validUtf8;) {
+        auto byte = static_cast<uint8_t>(text[i]);
+        size_t length = byte < 0x80 ? 1 : (byte >> 5) == 0x6 ? 2 : (byte >> 4) == 0xE ? 3 : (byte >> 3) == 0x1E ? 4 : 0;
+        if (length == 0 || i + length > text.size()) {
+            validUtf8 = false;
+            break;
+        }
+        for (size_t j = 1; j < length; j++) {
+            if ((static_cast<uint8_t>(text[i + j]) & 0xC0) != 0x80) validUtf8 = false;
+        }
+        i += length;
+    }
+
+    std::string json = "\"";
+    for (char c : text) {
+        auto byte = static_cast<uint8_t>(c);
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        } else if (byte < 0x20 || (byte >= 0x80 && !validUtf8)) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+            json += escaped;
+        } else {
+            json += c;
+        }
+    }
+    return json + "\"";
+}
+
+void MIDISplitter::openTrackOutput(TrackOutput& output, const fs::path& path,
+                                   const std::vector<uint8_t>& outputHeader) {
+    output.path = path;
+    output.file = std::make_unique<OutputFile>(path);
+    output.file->write(outputHeader.data(), outputHeader.size());
+    writeChunkHeader(*output.file, 0); // Length patched on close
+}
+
+void MIDISplitter::flushTrackOutput(TrackOutput& output) {
+    if (output.trackBytes + output.buffer.size() > MAX_MTRK_SIZE) {
+        throw std::runtime_error("Track of " + output.path.filename().string() + " is over 4 GB");
+    }
+    output.file->write(output.buffer.data(), output.buffer.size());
+    output.trackBytes += output.buffer.size();
+    output.buffer.clear();
+}
+
+void MIDISplitter::appendTrackEvent(TrackOutput& output, uint64_t tick, std::span<const uint8_t> event,
+                                    uint8_t status) {
+    uint64_t delta = tick - output.lastTick;
+    if (delta > 0x0FFFFFFF) {
+        output.runningStatus = 0; // Filler meta events go in between
+    }
+    appendDeltaTime(output.buffer, delta);
+    output.lastTick = tick;
+    size_t skip = (status != 0 && status == output.runningStatus) ? 1 : 0;
+    output.buffer.insert(output.buffer.end(), event.begin() + skip, event.end());
+    output.runningStatus = status;
+    output.events++;
+    if (output.buffer.size() >= TRACK_OUTPUT_BUFFER_SIZE) {
+        flushTrackOutput(output);
+    }
+}
+
+void MIDISplitter::closeTrackOutput(TrackOutput& output, uint64_t tick, size_t headerSize) {
+    const uint8_t endOfTrack[] = {0xFF, 0x2F, 0x00};
+    appendTrackEvent(output, tick, endOfTrack, 0);
+    flushTrackOutput(output);
+    output.file->writeAt(headerSize + 4, uint32ToBytes(static_cast<uint32_t>(output.trackBytes)).data(), 4);
+    output.file->close();
+}
+
+bool MIDISplitter::readStreamEvent(StreamReader& reader, uint8_t& runningStatus, StreamEvent& event) {
+    TrackEvent decoded;
+    std::span<const uint8_t> bytes;
+    EventParse result = reader.next(runningStatus, decoded, bytes);
+    if (result == EventParse::Truncated) return false;
+    if (result == EventParse::Malformed) {
+        throw std::runtime_error("Malformed event at tick " + std::to_string(event.tick));
+    }
+    event.tick += decoded.delta;
+    event.status = decoded.status;
+    event.metaType = decoded.metaType;
+    event.bytes.clear();
+    if (decoded.runningStatus) {
+        event.bytes.push_back(decoded.status);
+    }
+    event.bytes.insert(event.bytes.end(), bytes.begin() + decoded.body, bytes.end());
+    runningStatus = runningStatusAfter(decoded);
+    return true;
+}
+
+void MIDISplitter::splitFormat0(std::istream& in, const MIDIHeader& midiHeader, const std::string& baseName,
+                                const std::string& outputDir, const SplitOptions& options, PlannedOutputs* planned) {
+    log_ << "Format 0 file: splitting its track by MIDI channel" << std::endl;
+    if (options.selectsTracks() || options.maxPartSize > 0 || options.embedConductor) {
+        log_ << "Note: track selectors, --max-part-size and --conductor do not apply to Format 0 files" << std::endl;
+    }
+
+    std::vector<uint8_t> trackHeader(8);
+    uint64_t position = 14;
+    readChunkHeader(in, trackHeader, 1, position);
+    uint32_t trackSize = parseTrackHeader(trackHeader, 1);
+
+    std::vector<uint8_t> outputHeader = buildOutputHeader(midiHeader.division);
+    std::array<TrackOutput, 16> outputs;
+    std::array<uint64_t, 16> channelEvents{};
+    OutputReservations reservations(*this, planned);
+
+    // Latest event of each meta type a late output needs, in the order they were first seen
+    static constexpr std::array<uint8_t, 5> LATE_OUTPUT_META = {0x03, 0x04, 0x51, 0x58, 0x59};
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> lateState;
+    std::array<int, LATE_OUTPUT_META.size()> lateSlot;
+    lateSlot.fill(-1);
+
+    StreamReader reader(in, trackSize);
+    StreamEvent event;
+    uint8_t runningStatus = 0;
+    while (readStreamEvent(reader, runningStatus, event)) {
+        if (event.status < 0xF0) {
+            TrackOutput& output = outputs[event.status & 0x0F];
+            if (!output.file) {
+                fs::path path = reservations.reserve(outputDir, baseName, "Channel " + std::to_string((event.status & 0x0F) + 1));
+                openTrackOutput(output, path, outputHeader);
+                auto replay = lateState;
+                std::stable_sort(replay.begin(), replay.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+                for (const auto& [tick, bytes] : replay) {
+                    appendTrackEvent(output, tick, bytes, 0);
+                }
+            }
+            appendTrackEvent(output, event.tick, event.bytes, event.status);
+            channelEvents[event.status & 0x0F]++;
+        } else if (event.status == 0xFF && event.metaType == 0x2F) {
+            break;
+        } else {
+            auto kept = std::find(LATE_OUTPUT_META.begin(), LATE_OUTPUT_META.end(), event.metaType);
+            if (event.status == 0xFF && kept != LATE_OUTPUT_META.end()) {
+                int& slot = lateSlot[kept - LATE_OUTPUT_META.begin()];
+                if (slot < 0) {
+                    slot = static_cast<int>(lateState.size());
+                    lateState.emplace_back();
+                }
+                lateState[slot] = {event.tick, event.bytes};
+            }
+            for (TrackOutput& output : outputs) {
+                if (output.file) {
+                    appendTrackEvent(output, event.tick, event.bytes, 0);
+                }
+            }
+        }
+    }
+
+    // Close every output at the end of the source track
+    int splitCount = 0;
+    for (uint8_t channel = 0; channel < 16; channel++) {
+        TrackOutput& output = outputs[channel];
+        if (!output.file) continue;
+        closeTrackOutput(output, event.tick, outputHeader.size());
+
+        log_ << "Splitting: Channel " << channel + 1 << " (" << channelEvents[channel] << " events)" << std::endl;
+        log_ << "  -> Created: " << output.path.filename().string() << std::endl;
+        splitCount++;
+    }
+
+    if (splitCount == 0) {
+        log_ << "\nNo channel events found, nothing to split." << std::endl;
+        return;
+    }
+    log_ << "\nSuccessfully split " << splitCount << " channels!" << std::endl;
+}
+
+bool MIDISplitter::advanceCursor(MergeCursor& cursor) {
+    try {
+        return readStreamEvent(*cursor.reader, cursor.runningStatus, cursor.event) &&
+               !(cursor.event.status == 0xFF && cursor.event.metaType == 0x2F);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string(e.what()) + " in " + cursor.source);
+    }
+}
+
+void MIDISplitter::raiseOpenFileLimit() {
+
+#ifdef _WIN32
+    _setmaxstdio(8192);
+#else
+
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+}
+
+void MIDISplitter::splitMIDIStream(std::istream& in, int inFd, const std::string& baseName,
+                                   const std::string& outputDir, const SplitOptions& options, PlannedOutputs* planned) {
+    std::vector<uint8_t> headerData(14);
+    in.read(reinterpret_cast<char*>(headerData.data()), 14);
+    if (in.gcount() != 14) {
+        throw std::runtime_error("Error reading MIDI header.");
+    }
+    MIDIHeader midiHeader = parseHeader(headerData);
+    uint16_t totalTracks = midiHeader.trackCount;
+    if (midiHeader.format == 0) {
+        splitFormat0(in, midiHeader, baseName, outputDir, options, planned);
+        return;
+    }
+
+    log_ << "Found " << totalTracks << " tracks to split" << std::endl;
+    if (options.maxPartSize > 0) {
+        // Cutting walks each track before copying it, which a single pass cannot do
+        log_ << "Note: --max-part-size needs a regular input file, writing whole tracks" << std::endl;
+    }
+
+    OutputHeaders headers{buildOutputHeader(midiHeader.division), {}};
+    std::vector<uint8_t> trackHeader(8);
+    std::vector<uint8_t> leadIn;
+    std::vector<char> buffer;
+    std::regex nameRegex(options.nameRegex);
+    OutputReservations reservations(*this, planned);
+
+    // The header of each track after the first is read at the end of the track before it, so
+    // the previous output is only kept when its track really ended there
+    uint64_t trackStartPos = 14;
+    auto readTrackHeader = [&](uint16_t index, uint64_t position) {
+        readChunkHeader(in, trackHeader, index + 1, position);
+        if (index > 0) {
+            checkNextTrackHeader(trackHeader, index, "split it from a regular file without --stream to recover it");
+        }
+        trackStartPos = position;
+    };
+
+    int splitCount = 0;
+    if (totalTracks > 0) {
+        readTrackHeader(0, trackStartPos);
+    }
+    for (uint16_t i = 0; i < totalTracks; i++) {
+        uint32_t trackSize = parseTrackHeader(trackHeader, i + 1);
+
+        TrackInfo track;
+        track.number = i + 1;
+        track.size = trackSize;
+        track.declaredSize = trackSize;
+        track.position = trackStartPos;
+
+        // The name has to be known before the output can be created, so hold back the start of the track
+        describeTrack(track, readLeadIn(in, trackSize, leadIn), leadIn);
+        printTrackInfo(track);
+
+        // The conductor has to be known before any other track is written, so read all of track 1
+        if (i == 0 && options.embedConductor) {
+            if (trackSize <= MAX_STREAM_CONDUCTOR_SOURCE) {
+                size_t held = leadIn.size();
+                leadIn.resize(trackSize);
+                in.read(reinterpret_cast<char*>(leadIn.data() + held), static_cast<std::streamsize>(trackSize - held));
+                if (static_cast<size_t>(in.gcount()) != trackSize - held) {
+                    throw std::runtime_error("Unexpected end of input in track 1");
+                }
+                headers = buildOutputHeaders(midiHeader.division, leadIn, options);
+            } else {
+                log_ << "Note: track 1 is too large to hold in a single pass, no conductor embedded" << std::endl;
+            }
+        }
+
+        uint64_t trackEnd = trackStartPos + 8 + static_cast<uint64_t>(trackSize);
+        if (!trackSelected(track, options, nameRegex)) {
+            skipStream(in, trackSize - leadIn.size());
+            if (i + 1 < totalTracks) {
+                readTrackHeader(i + 1, trackEnd);
+            }
+            continue;
+        }
+
+        std::string trackType = (track.number == 1) ? "Tempo" : "Track";
+        log_ << "Splitting: " << trackType << " " << track.number << std::endl;
+
+        const std::vector<uint8_t>& outputHeader = headers.forTrack(track);
+        fs::path outputPath = reservations.reserve(outputDir, baseName, track.name);
+        OutputFile outFile(outputPath);
+        outFile.preallocate(outputHeader.size() + 8 + static_cast<uint64_t>(trackSize));
+        outFile.write(outputHeader.data(), outputHeader.size());
+        outFile.write(trackHeader.data(), trackHeader.size());
+        outFile.write(leadIn.data(), leadIn.size());
+
+        size_t bufferSize = chooseBufferSize(trackSize, options.cacheWindow);
+        if (buffer.size() < bufferSize) {
+            buffer.resize(bufferSize);
+        }
+
+        size_t remaining = trackSize - leadIn.size();
+
+#ifndef _WIN32
+        if (options.cacheWindow > 0) {
+            uint64_t copied = outputHeader.size() + trackHeader.size() + leadIn.size();
+            PageCacheWindow window(options.cacheWindow, inFd, trackStartPos + 8 + leadIn.size(), outFile.fd(), copied);
+            copyStream(in, outFile, remaining, buffer, &window);
+            window.finish();
+        } else
+#endif
+
+        {
+            (void)inFd;
+            copyStream(in, outFile, remaining, buffer);
+        }
+
+        if (i + 1 < totalTracks) {
+            try {
+                readTrackHeader(i + 1, trackEnd);
+            } catch (...) {
+                outFile.close();
+                std::error_code error;
+                fs::remove(outputPath, error);
+                throw;
+            }
+        }
+        outFile.close();
+        splitCount++;
+
+        log_ << "  -> Created: " << outputPath.filename().string() << std::endl;
+    }
+
+    log_ << "\nSuccessfully split " << splitCount << " tracks!" << std::endl;
+}
+
+#ifdef MIDISPLITTER_HAVE_IO_URING
+std::unique_ptr<IoUring> MIDISplitter::createIoUring() {
+    try {
+        auto ring = std::make_unique<IoUring>(IO_URING_QUEUE_DEPTH);
+        ring->registerFileSlots(ring->capacity() / IO_URING_OPS_PER_TRACK);
+        ring->probeDirectOpen();
+        return ring;
+    } catch (const std::exception& e) {
+        log_ << "io_uring unavailable (" << e.what() << "), using the regular writer" << std::endl;
+        return nullptr;
+    }
+}
+
+int MIDISplitter::writeTracksIoUring(IoUring& ring, const MappedFile& input, const std::vector<TrackInfo>& tracks,
+                                     const std::vector<fs::path>& outputPaths, const OutputHeaders& headers,
+                                     const SplitOptions& options) {
+    enum Op : uint64_t { OpOpen, OpAllocate, OpHeader, OpData, OpClose, OpReleaseSlot };
+    const unsigned batchLimit = ring.capacity() / IO_URING_OPS_PER_TRACK;
+
+    // Batches are sized so that every chain fits in the queue, and a chain cannot be split
+    // over two submissions without breaking its links, so running out is a bug
+    auto queue = [&](uint8_t opcode, unsigned slot, Op op, uint8_t flags) {
+        io_uring_sqe* sqe = ring.nextSqe();
+        if (sqe == nullptr) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+        sqe->opcode = opcode;
+        sqe->flags = flags;
+        sqe->user_data = (static_cast<uint64_t>(slot) << 3) | op;
+        return sqe;
+    };
+
+    int splitCount = 0;
+    std::vector<size_t> batch;
+    std::vector<size_t> batchBytes;
+    std::vector<bool> failed;
+    batch.reserve(batchLimit);
+
+    size_t index = 0;
+    while (index < tracks.size()) {
+        batch.clear();
+        batchBytes.clear();
+        while (index < tracks.size() && batch.size() < batchLimit &&
+               trackByteCount(input, tracks[index]) <= IO_URING_MAX_TRACK_BYTES &&
+               !needsRewrite(tracks[index], headers.forTrack(tracks[index]), options)) {
+            batch.push_back(index);
+            batchBytes.push_back(trackByteCount(input, tracks[index]));
+            index++;
+        }
+
+        if (batch.empty()) {
+            unsigned parts = writeTrackFile(input, outputPaths[index], headers.forTrack(tracks[index]), tracks[index], options);
+            printSplitResult(tracks[index], outputPaths[index], parts);
+            splitCount++;
+            index++;
+            continue;
+        }
+
+        for (unsigned slot = 0; slot < batch.size(); slot++) {
+            const TrackInfo& track = tracks[batch[slot]];
+            const std::vector<uint8_t>& outputHeader = headers.forTrack(track);
+
+            // O_CLOEXEC is meaningless (and rejected) for direct descriptors
+            io_uring_sqe* sqe = queue(IORING_OP_OPENAT, slot, OpOpen, IOSQE_IO_LINK);
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(outputPaths[batch[slot]].c_str());
+            sqe->len = 0644;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+            sqe->file_index = slot + 1;
+
+            // A hard link keeps the chain going on filesystems without fallocate
+            sqe = queue(IORING_OP_FALLOCATE, slot, OpAllocate, IOSQE_IO_HARDLINK | IOSQE_FIXED_FILE);
+            sqe->fd = static_cast<int>(slot);
+            sqe->off = 0;
+            sqe->addr = outputHeader.size() + batchBytes[slot];
+            sqe->len = FALLOC_FL_KEEP_SIZE;
+
+            sqe = queue(IORING_OP_WRITE, slot, OpHeader, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+            sqe->fd = static_cast<int>(slot);
+            sqe->addr = reinterpret_cast<uint64_t>(outputHeader.data());
+            sqe->len = static_cast<uint32_t>(outputHeader.size());
+            sqe->off = 0;
+
+            sqe = queue(IORING_OP_WRITE, slot, OpData, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+            sqe->fd = static_cast<int>(slot);
+            sqe->addr = reinterpret_cast<uint64_t>(input.bytes().data() + track.position);
+            sqe->len = static_cast<uint32_t>(batchBytes[slot]);
+            sqe->off = outputHeader.size();
+
+            sqe = queue(IORING_OP_CLOSE, slot, OpClose, 0);
+            sqe->file_index = slot + 1;
+        }
+        ring.submitAndWait();
+
+        failed.assign(batch.size(), false);
+        std::optional<size_t> noSpace; // A track whose preallocation ran out of space
+        io_uring_cqe cqe;
+        while (ring.nextCompletion(cqe)) {
+            unsigned slot = static_cast<unsigned>(cqe.user_data >> 3);
+            switch (cqe.user_data & 7) {
+                case OpAllocate:
+                    // Only a hint where fallocate is unsupported, but out of space is fatal,
+                    // as in preallocateOutput
+                    if (cqe.res == -ENOSPC && !noSpace) noSpace = batch[slot];
+                    break;
+                case OpHeader:
+                    if (cqe.res != static_cast<int>(headers.forTrack(tracks[batch[slot]]).size())) failed[slot] = true;
+                    break;
+                case OpData:
+                    if (cqe.res != static_cast<int>(batchBytes[slot])) failed[slot] = true;
+                    break;
+                default:
+                    if (cqe.res < 0) failed[slot] = true;
+                    break;
+            }
+        }
+
+        // A broken chain never reached its close, so release those table slots
+        if (std::find(failed.begin(), failed.end(), true) != failed.end()) {
+            for (unsigned slot = 0; slot < batch.size(); slot++) {
+                if (failed[slot]) {
+                    queue(IORING_OP_CLOSE, slot, OpReleaseSlot, 0)->file_index = slot + 1;
+                }
+            }
+            ring.submitAndWait();
+            while (ring.nextCompletion(cqe)) {}
+        }
+        if (noSpace) {
+            throw std::runtime_error("Not enough space for output file: " + outputPaths[*noSpace].string());
+        }
+
+        for (unsigned slot = 0; slot < batch.size(); slot++) {
+            // Batched tracks are never cut, so they always go to their output path
+            if (failed[slot]) {
+                writeTrackFile(input, outputPaths[batch[slot]], headers.forTrack(tracks[batch[slot]]), tracks[batch[slot]], options);
+            }
+            printSplitResult(tracks[batch[slot]], outputPaths[batch[slot]], 0);
+            splitCount++;
+        }
+    }
+    return splitCount;
+}
+#endif
+
+bool MIDISplitter::isForeignChunk(std::span<const uint8_t> header) {
+    if (header.size() < 8 || std::memcmp(header.data(), "MTrk", 4) == 0) return false;
+    return std::all_of(header.begin(), header.begin() + 4, [](uint8_t byte) { return byte >= 0x20 && byte < 0x7F; });
+}
+
+uint64_t MIDISplitter::skipForeignChunks(std::span<const uint8_t> data, uint64_t position) {
+    while (position <= data.size() && data.size() - position >= 8) {
+        auto header = data.subspan(static_cast<size_t>(position), 8);
+        if (!isForeignChunk(header) || bytesToUInt32(header, 4) > data.size() - position - 8) break;
+        position += 8 + static_cast<uint64_t>(bytesToUInt32(header, 4));
+    }
+    return position;
+}
+
+void MIDISplitter::readChunkHeader(std::istream& in, std::vector<uint8_t>& header, uint16_t trackNumber,
+                                   uint64_t& position) {
+    for (;;) {
+        in.read(reinterpret_cast<char*>(header.data()), 8);
+        if (in.gcount() != 8) {
+            throw std::runtime_error("Error reading track header " + std::to_string(trackNumber));
+        }
+        if (!isForeignChunk(header)) return;
+        uint32_t size = bytesToUInt32(header, 4);
+        skipStream(in, size);
+        if (!in) {
+            throw std::runtime_error("Error reading track header " + std::to_string(trackNumber));
+        }
+        position += 8 + static_cast<uint64_t>(size);
+    }
+}
+
+bool MIDISplitter::chunkEndsCleanly(std::span<const uint8_t> data, uint64_t end, bool lastTrack) {
+    if (end >= data.size()) return lastTrack;
+    auto next = data.subspan(static_cast<size_t>(end));
+    if (!lastTrack && next.size() >= 4 && std::memcmp(next.data(), "MTrk", 4) == 0) return true;
+    return isForeignChunk(next) && bytesToUInt32(next, 4) <= next.size() - 8;
+}
+
+size_t MIDISplitter::findTrackSignature(std::span<const uint8_t> data, size_t from) {
+    while (from + 4 <= data.size()) {
+        auto found = static_cast<const uint8_t*>(std::memchr(data.data() + from, 'M', data.size() - from - 3));
+        if (!found) break;
+        size_t pos = static_cast<size_t>(found - data.data());
+        if (std::memcmp(found, "MTrk", 4) == 0) return pos;
+        from = pos + 1;
+    }
+    return data.size();
+}
+
+uint64_t MIDISplitter::recoverTrackSize(std::span<const uint8_t> rest, uint16_t trackNumber, uint32_t declaredSize,
+                                        bool lastTrack) {
+    size_t size = findEndOfTrack(rest);
+    if (size == declaredSize) return size;
+    const char* source = "its End of Track event";
+    if (size == rest.size() + 1 || (!lastTrack && !chunkEndsCleanly(rest, size, false))) {
+        size = lastTrack ? rest.size() : findTrackSignature(rest, 0);
+        source = lastTrack ? "the end of the file" : "the next MTrk header";
+    }
+    if (size != declaredSize) {
+        log_ << "Note: track " << trackNumber << " declares " << declaredSize << " bytes but is " << size
+                  << " bytes long (found from " << source << ")" << std::endl;
+    }
+    return size;
+}
+
+MIDISplitter::TrackInfo MIDISplitter::indexTrack(std::span<const uint8_t> data, uint64_t trackStartPos, uint16_t i,
+                                                 uint16_t totalTracks) {
+    if (trackStartPos > data.size() || data.size() - trackStartPos < 8) {
+        throw std::runtime_error("Error reading track header " + std::to_string(i + 1));
+    }
+    uint32_t trackSize = parseTrackHeader(data.subspan(static_cast<size_t>(trackStartPos), 8), i + 1);
+
+    TrackInfo track;
+    track.number = i + 1;
+    track.size = trackSize;
+    track.declaredSize = trackSize;
+    track.position = trackStartPos;
+
+    size_t dataOffset = static_cast<size_t>(trackStartPos) + 8;
+    if (!chunkEndsCleanly(data, dataOffset + static_cast<uint64_t>(trackSize), i + 1 == totalTracks)) {
+        track.size = recoverTrackSize(data.subspan(dataOffset), track.number, trackSize, i + 1 == totalTracks);
+    }
+
+    // The last track of a truncated file only has what is left of the mapping
+    auto leadIn = data.subspan(dataOffset, static_cast<size_t>(std::min<uint64_t>({track.size, data.size() - dataOffset, MAX_METADATA_SCAN})));
+    describeTrack(track, readTrackMetadata(leadIn), leadIn);
+    return track;
+}
+
+std::vector<MIDISplitter::TrackInfo> MIDISplitter::indexTracks(std::span<const uint8_t> data, uint16_t totalTracks) {
+    std::vector<TrackInfo> tracks;
+    tracks.reserve(totalTracks); // Reserve space for ALL tracks including primary
+
+    // Process ALL tracks including the primary track
+    uint64_t trackStartPos = 14;
+    for (uint16_t i = 0; i < totalTracks; i++) {
+        trackStartPos = skipForeignChunks(data, trackStartPos);
+        tracks.push_back(indexTrack(data, trackStartPos, i, totalTracks));
+
+        // Skip to next track
+        trackStartPos += 8 + tracks.back().size;
+    }
+    return tracks;
+}
+
+void MIDISplitter::checkNextTrackHeader(std::span<const uint8_t> header, uint16_t previousTrack,
+                                        const std::string& remedy) {
+    if (header.size() < 4 || std::memcmp(header.data(), "MTrk", 4) != 0) {
+        throw std::runtime_error("The MTrk length of track " + std::to_string(previousTrack) +
+                                 " does not lead to the next track (the track is corrupted or over 4 GB); " + remedy);
+    }
+}
+
+MIDISplitter::InputFingerprint MIDISplitter::fingerprintInput(const std::string& inputFile,
+                                                              std::span<const uint8_t> data) {
+    InputFingerprint fingerprint;
+    fingerprint.size = data.size();
+    fingerprint.modified = static_cast<uint64_t>(fs::last_write_time(inputFile).time_since_epoch().count());
+
+    // FNV-1a over the header region catches files rewritten within the mtime granularity
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint8_t byte : data.first(std::min(data.size(), INDEX_HASHED_BYTES))) {
+        hash = (hash ^ byte) * 0x100000001b3ULL;
+    }
+    fingerprint.headerHash = hash;
+    return fingerprint;
+}
+
+std::string MIDISplitter::indexPathFor(const std::string& inputFile) {
+    return inputFile + ".midx";
+}
+
+bool MIDISplitter::trackTableFits(std::span<const uint8_t> data, const std::vector<TrackInfo>& tracks) {
+    uint64_t position = 14;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const TrackInfo& track = tracks[i];
+        position = skipForeignChunks(data, position);
+        if (track.number != i + 1 || track.position != position || track.size > data.size() ||
+            track.position + 8 + track.size > data.size() ||
+            std::memcmp(data.data() + track.position, "MTrk", 4) != 0 ||
+            bytesToUInt32(data, static_cast<size_t>(track.position) + 4) != track.declaredSize) {
+            return false;
+        }
+        position += 8 + track.size;
+    }
+    return true;
+}
+
+bool MIDISplitter::loadTrackIndex(const std::string& inputFile, const InputFingerprint& fingerprint,
+                                  const MIDIHeader& midiHeader, std::span<const uint8_t> data,
+                                  std::vector<TrackInfo>& tracks) {
+    std::string indexPath = indexPathFor(inputFile);
+    std::error_code error;
+    if (!fs::is_regular_file(indexPath, error)) return false;
+
+    try {
+        MappedFile indexFile(indexPath);
+        std::span<const uint8_t> index = indexFile.bytes();
+        if (index.size() < INDEX_HEADER_SIZE || std::string(index.begin(), index.begin() + 4) != "MIDX" ||
+            bytesToUInt32(index, 4) != INDEX_VERSION) {
+            return false;
+        }
+        if (bytesToUInt64(index, 8) != fingerprint.size || bytesToUInt64(index, 16) != fingerprint.modified ||
+            bytesToUInt64(index, 24) != fingerprint.headerHash) {
+            return false;
+        }
+
+        uint16_t trackCount = bytesToUInt16(index, 34);
+        if (bytesToUInt16(index, 32) != midiHeader.format || trackCount != midiHeader.trackCount ||
+            bytesToUInt16(index, 36) != midiHeader.division) {
+            return false;
+        }
+
+        size_t namesOffset = INDEX_HEADER_SIZE + trackCount * INDEX_RECORD_SIZE;
+        if (index.size() < namesOffset) return false;
+        std::span<const uint8_t> names = index.subspan(namesOffset);
+
+        std::vector<TrackInfo> loaded;
+        loaded.reserve(trackCount);
+        for (size_t i = 0; i < trackCount; i++) {
+            size_t record = INDEX_HEADER_SIZE + i * INDEX_RECORD_SIZE;
+            uint32_t nameOffset = bytesToUInt32(index, record + 20);
+            uint32_t nameLength = bytesToUInt32(index, record + 24);
+            uint32_t instrumentOffset = bytesToUInt32(index, record + 28);
+            uint32_t instrumentLength = bytesToUInt32(index, record + 32);
+            if (static_cast<uint64_t>(nameOffset) + nameLength > names.size() ||
+                static_cast<uint64_t>(instrumentOffset) + instrumentLength > names.size()) {
+                return false;
+            }
+
+            TrackInfo track;
+            track.position = bytesToUInt64(index, record);
+            track.size = bytesToUInt64(index, record + 8);
+            track.declaredSize = bytesToUInt32(index, record + 16);
+            track.number = bytesToUInt16(index, record + 36);
+            uint16_t program = bytesToUInt16(index, record + 38);
+            track.program = program == 0xFFFF ? -1 : static_cast<int16_t>(program);
+            track.channels = bytesToUInt16(index, record + 40);
+            track.name.assign(names.begin() + nameOffset, names.begin() + nameOffset + nameLength);
+            track.instrument.assign(names.begin() + instrumentOffset, names.begin() + instrumentOffset + instrumentLength);
+            loaded.push_back(std::move(track));
+        }
+        if (!trackTableFits(data, loaded)) return false;
+        tracks = std::move(loaded);
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void MIDISplitter::saveTrackIndex(const std::string& inputFile, const InputFingerprint& fingerprint,
+                                  const MIDIHeader& midiHeader, const std::vector<TrackInfo>& tracks) {
+    std::vector<uint8_t> index = {'M', 'I', 'D', 'X'};
+    auto append = [&index](const std::vector<uint8_t>& bytes) {
+        index.insert(index.end(), bytes.begin(), bytes.end());
+    };
+    append(uint32ToBytes(INDEX_VERSION));
+    append(uint64ToBytes(fingerprint.size));
+    append(uint64ToBytes(fingerprint.modified));
+    append(uint64ToBytes(fingerprint.headerHash));
+    append(uint16ToBytes(midiHeader.format));
+    append(uint16ToBytes(static_cast<uint16_t>(tracks.size())));
+    append(uint16ToBytes(midiHeader.division));
+    append(uint16ToBytes(0));
+
+    std::string names;
+    for (const auto& track : tracks) {
+        append(uint64ToBytes(track.position));
+        append(uint64ToBytes(track.size));
+        append(uint32ToBytes(track.declaredSize));
+        append(uint32ToBytes(static_cast<uint32_t>(names.size())));
+        append(uint32ToBytes(static_cast<uint32_t>(track.name.size())));
+        names += track.name;
+        append(uint32ToBytes(static_cast<uint32_t>(names.size())));
+        append(uint32ToBytes(static_cast<uint32_t>(track.instrument.size())));
+        names += track.instrument;
+        append(uint16ToBytes(track.number));
+        append(uint16ToBytes(track.program < 0 ? 0xFFFF : static_cast<uint16_t>(track.program)));
+        append(uint16ToBytes(track.channels));
+        append(uint16ToBytes(0));
+    }
+    index.insert(index.end(), names.begin(), names.end());
+
+    std::string indexPath = indexPathFor(inputFile);
+    // Unique per process and call, so concurrent saves of the same index never share a file;
+    // whichever rename comes last wins, and both wrote a complete index
+    static std::atomic<unsigned> saveCounter{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = static_cast<unsigned long>(::getpid());
+#endif
+    std::string tempPath = indexPath + "." + std::to_string(pid) + "." + std::to_string(saveCounter++) + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size()));
+        out.close();
+        if (!out) {
+            std::error_code error;
+            fs::remove(tempPath, error);
+            throw std::runtime_error("Cannot write track index: " + indexPath);
+        }
+    }
+    fs::rename(tempPath, indexPath);
+}
+
+void MIDISplitter::inspectMIDIFile(const std::string& inputFile, std::ostream& out) {
+    bool mapped = inputFile != "-" && fs::is_regular_file(inputFile);
+    std::unique_ptr<MappedFile> input;
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    std::vector<uint8_t> headerData(14);
+    if (mapped) {
+        input = std::make_unique<MappedFile>(inputFile);
+        input->adviseRandom();
+        if (input->size() < 14) {
+            throw std::runtime_error("Error reading MIDI header.");
+        }
+        std::copy_n(input->bytes().begin(), 14, headerData.begin());
+    } else {
+        if (inputFile == "-") {
+
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+        } else {
+            file.open(inputFile, std::ios::binary);
+            if (!file) {
+                throw std::runtime_error("Cannot open file: " + inputFile);
+            }
+            in = &file;
+        }
+        in->read(reinterpret_cast<char*>(headerData.data()), 14);
+        if (in->gcount() != 14) {
+            throw std::runtime_error("Error reading MIDI header.");
+        }
+    }
+    MIDIHeader midiHeader = parseHeader(headerData);
+
+    out << "{\"file\": " << jsonString(inputFile) << ", \"format\": " << midiHeader.format
+        << ", \"division\": " << midiHeader.division << ", \"trackCount\": " << midiHeader.trackCount
+        << ", \"tracks\": [" << std::endl;
+
+    std::vector<uint8_t> trackHeader(8);
+    std::vector<uint8_t> leadIn;
+    uint64_t trackStartPos = 14;
+    uint16_t printed = 0;
+
+    // As in a stream split, the header of each track after the first is read at the end of
+    // the track before it, so an entry is only printed once its length is known to be right
+    auto readTrackHeader = [&](uint16_t index, uint64_t position) {
+        readChunkHeader(*in, trackHeader, index + 1, position);
+        if (index > 0) {
+            checkNextTrackHeader(trackHeader, index, "inspect the file by its path to measure it again");
+        }
+        trackStartPos = position;
+    };
+
+    try {
+        if (!mapped && midiHeader.trackCount > 0) {
+            readTrackHeader(0, trackStartPos);
+        }
+        for (uint16_t i = 0; i < midiHeader.trackCount; i++) {
+            TrackInfo track;
+            if (mapped) {
+                trackStartPos = skipForeignChunks(input->bytes(), trackStartPos);
+                track = indexTrack(input->bytes(), trackStartPos, i, midiHeader.trackCount);
+                trackStartPos += 8 + track.size;
+            } else {
+                track.number = i + 1;
+                track.size = track.declaredSize = parseTrackHeader(trackHeader, track.number);
+                track.position = trackStartPos;
+                describeTrack(track, readLeadIn(*in, track.size, leadIn), leadIn);
+                skipStream(*in, track.size - leadIn.size());
+                if (i + 1 < midiHeader.trackCount) {
+                    readTrackHeader(i + 1, track.position + 8 + track.size);
+                }
+            }
+
+            printTrackJson(out, track, i == 0);
+            printed++;
+
+            // Flush in batches so consumers see tracks as they are found without a write per track
+            if (i % 64 == 0) out.flush();
+        }
+    } catch (const std::exception& e) {
+        out << (printed > 0 ? "\n" : "") << "], \"error\": " << jsonString(e.what()) << "}" << std::endl;
+        throw;
+    }
+    out << (printed > 0 ? "\n" : "") << "]}" << std::endl;
+}
+
+void MIDISplitter::printTrackJson(std::ostream& out, const TrackInfo& track, bool first) {
+    out << (first ? "" : ",\n") << "  {\"number\": " << track.number << ", \"offset\": " << track.position
+        << ", \"size\": " << track.size << ", \"name\": " << jsonString(track.name)
+        << ", \"instrument\": " << jsonString(track.instrument) << ", \"program\": ";
+    if (track.program >= 0) {
+        out << track.program;
+    } else {
+        out << "null";
+    }
+    out << ", \"channels\": [";
+    const char* separator = "";
+    for (int channel = 0; channel < 16; channel++) {
+        if (track.channels & (1u << channel)) {
+            out << separator << channel + 1;
+            separator = ", ";
+        }
+    }
+    out << "]}";
+}
+
+void MIDISplitter::statsMIDIFile(const std::string& inputFile, const SplitOptions& options) {
+    log_ << "Reading MIDI file: " << inputFile << std::endl;
+    if (inputFile == "-" || !fs::is_regular_file(inputFile)) {
+        throw std::runtime_error("Statistics need a regular input file: " + inputFile);
+    }
+
+    MappedFile input(inputFile);
+    std::span<const uint8_t> data = input.bytes();
+    if (data.size() < 14) {
+        throw std::runtime_error("Error reading MIDI header.");
+    }
+    MIDIHeader midiHeader = parseHeader(data.first(14));
+    log_ << "Found " << midiHeader.trackCount << " tracks" << std::endl;
+
+    std::vector<TrackInfo> tracks = indexTracks(data, midiHeader.trackCount);
+    selectTracks(tracks, options);
+
+    unsigned jobs = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = static_cast<unsigned>(std::clamp<size_t>(jobs, 1, std::max<size_t>(tracks.size(), 1)));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TrackStats> stats = collectTrackStats(input, tracks, jobs);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    log_ << std::endl << std::right << std::setw(6) << "Track" << std::setw(14) << "Events" << std::setw(14) << "Notes"
+              << std::setw(14) << "Ticks" << std::setw(10) << "Poly" << "  Channels / Name" << std::endl;
+    TrackStats total;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        const TrackStats& track = stats[i];
+        std::string channels;
+        for (int channel = 0; channel < 16; channel++) {
+            if (track.channels & (1u << channel)) {
+                channels += (channels.empty() ? "" : ",") + std::to_string(channel + 1);
+            }
+        }
+        log_ << std::setw(6) << tracks[i].number << std::setw(14) << track.events << std::setw(14) << track.notes
+                  << std::setw(14) << track.ticks << std::setw(10) << track.maxPolyphony << "  "
+                  << (channels.empty() ? "-" : channels) << " / " << tracks[i].name
+                  << (track.malformed ? " (stopped at a malformed event)" : "") << std::endl;
+
+        total.events += track.events;
+        total.notes += track.notes;
+        total.ticks = std::max(total.ticks, track.ticks);
+    }
+
+    double seconds = std::max(elapsed.count(), 1e-9);
+    log_ << std::endl << "Total: " << total.events << " events, " << total.notes << " notes, "
+              << total.ticks << " ticks long" << std::endl
+              << "Decoded in " << std::fixed << std::setprecision(3) << seconds << " s on " << jobs << " thread"
+              << (jobs == 1 ? "" : "s") << " (" << std::setprecision(1) << total.events / seconds / 1e6
+              << " million events/s)" << std::endl;
+}
+
+void MIDISplitter::mergeMIDIFiles(const std::vector<std::string>& inputFiles, const std::string& outputFile) {
+    raiseOpenFileLimit();
+    std::vector<std::unique_ptr<MergeCursor>> cursors;
+    uint16_t division = 0;
+    for (const auto& inputFile : inputFiles) {
+        MappedFile input(inputFile);
+        std::span<const uint8_t> data = input.bytes();
+        if (data.size() < 14) {
+            throw std::runtime_error("Error reading MIDI header of " + inputFile);
+        }
+        MIDIHeader midiHeader = parseHeader(data.first(14));
+        if (cursors.empty()) {
+            division = midiHeader.division;
+        } else if (midiHeader.division != division) {
+            throw std::runtime_error("Cannot merge " + inputFile + ": its division (" + std::to_string(midiHeader.division) +
+                                     ") differs from the first input's (" + std::to_string(division) + ")");
+        }
+
+        for (const auto& track : indexTracks(data, midiHeader.trackCount)) {
+            auto cursor = std::make_unique<MergeCursor>();
+            cursor->source = inputFile + " track " + std::to_string(track.number);
+            cursor->file.open(inputFile, std::ios::binary);
+            if (!cursor->file || !cursor->file.seekg(static_cast<std::streamoff>(track.position + 8))) {
+                throw std::runtime_error("Cannot open " + cursor->source + " (too many open files?)");
+            }
+            cursor->reader = std::make_unique<StreamReader>(cursor->file, track.size, MERGE_READ_BUFFER_SIZE);
+            cursors.push_back(std::move(cursor));
+        }
+    }
+    log_ << "Merging " << cursors.size() << " tracks from " << inputFiles.size() << " files" << std::endl;
+
+    // Heap of the cursors that still have events, earliest (tick, index) on top
+    std::vector<size_t> heap;
+    auto later = [&cursors](size_t a, size_t b) {
+        uint64_t tickA = cursors[a]->event.tick;
+        uint64_t tickB = cursors[b]->event.tick;
+        return tickA != tickB ? tickA > tickB : a > b;
+    };
+    uint64_t endTick = 0;
+    for (size_t index = 0; index < cursors.size(); index++) {
+        if (advanceCursor(*cursors[index])) {
+            heap.push_back(index);
+        }
+        endTick = std::max(endTick, cursors[index]->event.tick);
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    std::vector<uint8_t> outputHeader = buildOutputHeader(division);
+    outputHeader[9] = 0; // Format 0
+    TrackOutput output;
+    openTrackOutput(output, outputFile, outputHeader);
+
+    std::vector<std::vector<uint8_t>> conductorEvents; // Written at the current tick
+    uint64_t conductorTick = 0;
+    std::optional<std::vector<uint8_t>> trackName;     // The one track name meta event kept
+    std::vector<uint8_t> text;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        MergeCursor& cursor = *cursors[heap.back()];
+        const StreamEvent& event = cursor.event;
+
+        bool write = true;
+        if (event.status == 0xFF && event.metaType == 0x03) {
+            // One track has one name: the first one seen (the conductor's, in a merged split)
+            // stays, repeats of it are dropped and the other names are kept as text events
+            if (!trackName) {
+                trackName = event.bytes;
+            } else if (event.bytes != *trackName) {
+                text = event.bytes;
+                text[1] = 0x01;
+                appendTrackEvent(output, event.tick, text, 0);
+                write = false;
+            } else {
+                write = false;
+            }
+        } else if (event.status == 0xFF && (event.metaType == 0x51 || event.metaType == 0x58 || event.metaType == 0x59)) {
+            if (event.tick != conductorTick) {
+                conductorEvents.clear();
+                conductorTick = event.tick;
+            }
+            write = std::find(conductorEvents.begin(), conductorEvents.end(), event.bytes) == conductorEvents.end();
+            if (write) conductorEvents.push_back(event.bytes);
+        }
+        if (write) {
+            appendTrackEvent(output, event.tick, event.bytes, event.status < 0xF0 ? event.status : 0);
+        }
+
+        if (advanceCursor(cursor)) {
+            std::push_heap(heap.begin(), heap.end(), later);
+        } else {
+            heap.pop_back();
+            cursor.reader.reset();
+            cursor.file.close();
+        }
+        endTick = std::max(endTick, cursor.event.tick);
+    }
+
+    uint64_t events = output.events;
+    closeTrackOutput(output, endTick, outputHeader.size());
+    log_ << "  -> Created: " << output.path.filename().string() << " (" << events << " events, "
+              << endTick << " ticks)" << std::endl;
+}
+
+std::vector<MIDISplitter::TrackInfo> MIDISplitter::loadTracks(const std::string& inputFile,
+                                                              std::span<const uint8_t> data,
+                                                              const MIDIHeader& midiHeader, bool useIndex) {
+    std::vector<TrackInfo> tracks;
+    if (!useIndex) {
+        return indexTracks(data, midiHeader.trackCount);
+    }
+
+    InputFingerprint fingerprint = fingerprintInput(inputFile, data);
+    if (loadTrackIndex(inputFile, fingerprint, midiHeader, data, tracks)) {
+        log_ << "Loaded track index: " << indexPathFor(inputFile) << std::endl;
+        return tracks;
+    }
+    tracks = indexTracks(data, midiHeader.trackCount);
+    if (!trackTableFits(data, tracks)) {
+        log_ << "Note: the last track is cut off, no track index saved" << std::endl;
+        return tracks;
+    }
+    try {
+        saveTrackIndex(inputFile, fingerprint, midiHeader, tracks);
+        log_ << "Saved track index: " << indexPathFor(inputFile) << std::endl;
+    } catch (const std::exception& e) {
+        log_ << "Note: " << e.what() << std::endl;
+    }
+    return tracks;
+}
+
+MIDISplitter::SplitPlan MIDISplitter::planSplit(const std::string& inputFile, const std::string& outputDir,
+                                                const SplitOptions& options, PlannedOutputs* planned) {
+    // Map the whole file; every pass below reads it through spans
+    SplitPlan plan;
+    plan.input = std::make_unique<MappedFile>(inputFile);
+    const MappedFile& input = *plan.input;
+    std::span<const uint8_t> data = input.bytes();
+    input.adviseRandom();
+
+    // Read and validate MIDI header
+    if (data.size() < 14) {
+        throw std::runtime_error("Error reading MIDI header.");
+    }
+    MIDIHeader midiHeader = parseHeader(data.first(14));
+    uint16_t totalTracks = midiHeader.trackCount;
+    plan.header = midiHeader;
+    if (midiHeader.format == 0) {
+        return plan;
+    }
+
+    log_ << "Found " << totalTracks << " tracks to split" << std::endl;
+
+    std::vector<TrackInfo>& tracks = plan.tracks;
+    tracks = loadTracks(inputFile, data, midiHeader, options.useIndex);
+    for (const auto& track : tracks) {
+        printTrackInfo(track);
+    }
+
+    // The conductor comes from track 1 whether or not it is selected
+    std::span<const uint8_t> firstTrack;
+    if (options.embedConductor && !tracks.empty()) {
+        size_t available = trackByteCount(input, tracks[0]);
+        firstTrack = data.subspan(static_cast<size_t>(tracks[0].position) + 8, available > 8 ? available - 8 : 0);
+    }
+    plan.headers = buildOutputHeaders(midiHeader.division, firstTrack, options);
+
+    // Drop unselected tracks up front so their bytes are never read
+    selectTracks(tracks, options);
+
+    fs::path inputPath(inputFile);
+    std::string baseName = inputPath.stem().string();
+
+    // Cloned tracks take almost no new space, but any clone may be refused and written as a
+    // copy instead, so --reflink outputs are counted as copies as well
+    uint64_t requiredBytes = 0;
+    for (const auto& track : tracks) {
+        requiredBytes += plan.headers.forTrack(track).size() + trackByteCount(input, track);
+    }
+    checkFreeSpace(outputDir, requiredBytes, tracks.size());
+
+    plan.outputPaths = planOutputPaths(outputDir, baseName, tracks, plan.headers, options, plan.partPaths, planned);
+    plan.partCounts.assign(tracks.size(), 0);
+    return plan;
+}
+
+void MIDISplitter::splitMIDIFile(const std::string& inputFile, const std::string& outputDir,
+                                 const SplitOptions& options, PlannedOutputs* planned) {
+    log_ << "Reading MIDI file: " << inputFile << std::endl;
+
+    // Pipes and stdin cannot be mapped or seeked, so they always take the single pass
+    bool fromStdin = inputFile == "-";
+    if (options.singlePass || fromStdin || !fs::is_regular_file(inputFile)) {
+        if (fromStdin) {
+
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+#ifdef _WIN32
+            ReadAheadBuffer readAhead(std::cin);
+#else
+            ReadAheadBuffer readAhead(STDIN_FILENO);
+#endif
+            std::istream in(&readAhead);
+            splitMIDIStream(in, 0, "stdin", outputDir, options, planned);
+            return;
+        }
+
+        std::ifstream file(inputFile, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Cannot open file: " + inputFile);
+        }
+
+        // Reading ahead cannot seek, so a regular file whose unselected tracks can be
+        // skipped by seeking is read directly
+#ifndef _WIN32
+        FileDescriptor readAheadFd;
+#endif
+        std::unique_ptr<ReadAheadBuffer> readAhead;
+        if (!options.selectsTracks() || !fs::is_regular_file(inputFile)) {
+#ifdef _WIN32
+            readAhead = std::make_unique<ReadAheadBuffer>(file);
+#else
+            readAheadFd.reset(::open(inputFile.c_str(), O_RDONLY | O_CLOEXEC));
+            if (!readAheadFd) {
+                throw std::runtime_error("Cannot open file: " + inputFile);
+            }
+            readAhead = std::make_unique<ReadAheadBuffer>(readAheadFd.get());
+#endif
+        }
+        std::istream in(readAhead ? static_cast<std::streambuf*>(readAhead.get()) : file.rdbuf());
+
+#ifdef __linux__
+        // A second descriptor on the same file lets the cache window drop what has been read
+        FileDescriptor adviceFd(options.cacheWindow > 0 ? ::open(inputFile.c_str(), O_RDONLY | O_CLOEXEC) : -1);
+        splitMIDIStream(in, adviceFd.get(), fs::path(inputFile).stem().string(), outputDir, options, planned);
+#else
+
+        splitMIDIStream(in, -1, fs::path(inputFile).stem().string(), outputDir, options, planned);
+#endif
+
+        return;
+    }
+
+    SplitPlan plan = planSplit(inputFile, outputDir, options);
+    MIDIHeader midiHeader = plan.header;
+
+    // A Format 0 split has to decode every event, which the stream splitter does in one pass
+    if (midiHeader.format == 0) {
+        plan.input.reset();
+        std::ifstream file(inputFile, std::ios::binary);
+        if (!file.seekg(14)) {
+            throw std::runtime_error("Cannot open file: " + inputFile);
+        }
+        splitFormat0(file, midiHeader, fs::path(inputFile).stem().string(), outputDir, options, planned);
+        return;
+    }
+
+    const MappedFile& input = *plan.input;
+    const std::vector<TrackInfo>& tracks = plan.tracks;
+    const std::vector<fs::path>& outputPaths = plan.outputPaths;
+    const OutputHeaders& headers = plan.headers;
+
+    unsigned jobs = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = static_cast<unsigned>(std::min<size_t>(jobs, tracks.size()));
+
+#ifdef MIDISPLITTER_HAVE_IO_URING
+    std::unique_ptr<IoUring> ring;
+    if (options.ioUring && !options.reflinkAligned && !options.directIO) {
+        ring = createIoUring();
+        if (ring && options.jobs != 1) {
+            log_ << "Note: --jobs does not apply to the io_uring writer, which submits from one thread" << std::endl;
+        }
+    }
+#else
+
+    if (options.ioUring) {
+        log_ << "io_uring is not available in this build, using the regular writer" << std::endl;
+    }
+#endif
+
+    // Create output files - each containing only ONE track
+    int splitCount = 0;
+
+#ifdef MIDISPLITTER_HAVE_IO_URING
+    if (ring) {
+        splitCount = writeTracksIoUring(*ring, input, tracks, outputPaths, headers, options);
+    } else
+#endif
+
+    if (jobs > 1) {
+        splitCount = writeTracksParallel(input, tracks, outputPaths, headers, options, jobs);
+    } else {
+        for (size_t index = 0; index < tracks.size(); index++) {
+            unsigned parts = writeTrackFile(input, outputPaths[index], headers.forTrack(tracks[index]), tracks[index], options);
+            printSplitResult(tracks[index], outputPaths[index], parts);
+            splitCount++;
+        }
+    }
+
+    if (reflinkRefused) {
+        log_ << "\n(Filesystem refused to clone track data, it was copied instead)" << std::endl;
+    }
+    if (directRefused) {
+        log_ << "\n(Filesystem does not support O_DIRECT, outputs were written through the page cache)" << std::endl;
+    }
+
+    log_ << "\nSuccessfully split " << splitCount << " tracks!" << std::endl;
+}
+
+} // namespace midisplitter::detail
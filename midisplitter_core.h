@@ -0,0 +1,1793 @@
+// The splitter itself, shared by the command line tool (midisplitter2.cpp) and the library
+// (midisplitter_lib.cpp); its members are defined in midisplitter_core.cpp, which both are linked
+// with. Everything here is in midisplitter::detail, which a shared library does not export, so
+// none of it can clash with the names of a program the library is linked into.
+#ifndef MIDISPLITTER_CORE_H
+#define MIDISPLITTER_CORE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <iomanip>
+#include <cstdint>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <span>
+#include <bit>
+#include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <cstdlib>
+#include <cctype>
+#include <csignal>
+#include <cstdio>
+#include <regex>
+#include <utility>
+#include <limits>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <sstream>
+#include <optional>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <commdlg.h>
+    #include <shlobj.h>
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/resource.h>
+    #include <sys/socket.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #include <ctime>
+#endif
+
+#ifdef __linux__
+    #include <sys/sendfile.h>
+    #include <sys/vfs.h>
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+    #include <sys/syscall.h>
+    #include <sys/inotify.h>
+    #include <sys/signalfd.h>
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        // Direct (fixed table) descriptors from IORING_OP_OPENAT are needed to link a whole
+        // track's open/write/close; IORING_FILE_INDEX_ALLOC marks headers that have them
+        #ifdef IORING_FILE_INDEX_ALLOC
+            #define MIDISPLITTER_HAVE_IO_URING 1
+        #endif
+    #endif
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+    #include <immintrin.h>
+    #define MIDISPLITTER_HAVE_SSE2 1
+    // GCC and Clang can compile an AVX2 variant into a baseline build and pick it at runtime
+    #if defined(__GNUC__)
+        #define MIDISPLITTER_HAVE_AVX2 1
+    #endif
+#endif
+
+#include "midisplitter.h"
+
+// Keeps the engine out of the exports of a shared library built with it
+#if defined(__GNUC__) && !defined(_WIN32)
+    #define MIDISPLITTER_INTERNAL __attribute__((visibility("hidden")))
+#else
+    #define MIDISPLITTER_INTERNAL
+#endif
+
+namespace midisplitter {
+namespace MIDISPLITTER_INTERNAL detail {
+
+namespace fs = std::filesystem;
+
+// Options controlling how splitMIDIFile lays out and writes the output files
+struct SplitOptions {
+    // Insert an alignment chunk after MThd so the MTrk data shares the source's
+    // filesystem block offset and can be cloned with FICLONERANGE (Linux only)
+    bool reflinkAligned = false;
+
+    // Read the input strictly front to back, writing each track as soon as its MTrk
+    // header is parsed; used automatically when the input is a pipe or stdin ("-")
+    bool singlePass = false;
+
+    // Number of tracks written concurrently; 0 uses every hardware thread
+    unsigned jobs = 1;
+
+    // Batch the open/fallocate/write/close of many small tracks through io_uring (Linux only,
+    // falls back to the regular writer when io_uring is unavailable)
+    bool ioUring = false;
+
+    // When non-zero, limit the page cache a copy leaves behind to about this many bytes per
+    // input and output: writeback is started behind the write cursor and finished windows
+    // are dropped from the cache (Linux only)
+    size_t cacheWindow = 0;
+
+    // Write outputs with O_DIRECT through a pool of aligned buffers, bypassing the page cache
+    // (Linux only, falls back to buffered writes where the filesystem refuses O_DIRECT)
+    bool directIO = false;
+
+    // Keep a "<input>.midx" sidecar with the header fields and track table next to the input,
+    // and load it instead of re-scanning the file while the input is unchanged
+    bool useIndex = false;
+
+    // Track selection, applied to the track table before any output is opened: only tracks
+    // matching every selector given are written
+    std::vector<std::pair<uint16_t, uint16_t>> trackRanges; // Inclusive track number ranges; empty selects all
+    std::string nameRegex;                                   // ECMAScript pattern searched for in the track name
+    uint64_t minSize = 0;                                    // Bounds on the MTrk data length in bytes
+    uint64_t maxSize = std::numeric_limits<uint64_t>::max();
+
+    // When non-zero, outputs larger than this many bytes are cut at event boundaries into
+    // "<name> (part N).mid" files of at most this size
+    uint64_t maxPartSize = 0;
+
+    // Write every track after the first as a two-track file, preceded by a conductor track with
+    // the tempo, time signature and key signature events of track 1
+    bool embedConductor = false;
+
+    bool selectsTracks() const {
+        return !trackRanges.empty() || !nameRegex.empty() || minSize > 0 ||
+               maxSize != std::numeric_limits<uint64_t>::max();
+    }
+};
+
+#ifdef __linux__
+// Reserve an output's final size before writing so the filesystem can lay it out in as few
+// extents as possible. KEEP_SIZE leaves the visible size to the writes themselves; filesystems
+// without fallocate simply allocate as the data arrives.
+inline void preallocateOutput(int fd, uint64_t size, const fs::path& outputPath) {
+    if (size > 0 && ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) != 0 && errno == ENOSPC) {
+        throw std::runtime_error("Not enough space for output file: " + outputPath.string());
+    }
+}
+#endif
+
+#ifndef _WIN32
+// Write a whole buffer to a file descriptor, retrying short writes
+inline void writeAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Error writing to output file: ") + std::strerror(errno));
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+#endif
+
+// Locate the next FF 03 (track name) or FF 04 (instrument name) meta event header at or after
+// `from`, returning its offset or `size` when there is none. FF only occurs in meta events in
+// practice, so all variants scan for FF alone, memchr style, and check the type byte per hit.
+inline size_t findNameMetaScalar(const uint8_t* data, size_t size, size_t from) {
+    while (from + 1 < size) {
+        auto found = static_cast<const uint8_t*>(std::memchr(data + from, 0xFF, size - from - 1));
+        if (!found) break;
+        size_t pos = static_cast<size_t>(found - data);
+        if (data[pos + 1] == 0x03 || data[pos + 1] == 0x04) return pos;
+        from = pos + 1;
+    }
+    return size;
+}
+
+#ifdef MIDISPLITTER_HAVE_SSE2
+inline size_t findNameMetaSSE2(const uint8_t* data, size_t size, size_t from) {
+    const __m128i status = _mm_set1_epi8(static_cast<char>(0xFF));
+    // Each step covers 32 positions; the type byte of the last one is still inside the buffer
+    for (; from + 33 <= size; from += 32) {
+        __m128i low = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from)), status);
+        __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + 16)), status);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(low)) |
+                        (static_cast<unsigned>(_mm_movemask_epi8(high)) << 16);
+        for (; mask; mask &= mask - 1) {
+            size_t pos = from + static_cast<size_t>(std::countr_zero(mask));
+            if (data[pos + 1] == 0x03 || data[pos + 1] == 0x04) return pos;
+        }
+    }
+    return findNameMetaScalar(data, size, from);
+}
+#endif
+
+#ifdef MIDISPLITTER_HAVE_AVX2
+__attribute__((target("avx2")))
+inline size_t findNameMetaAVX2(const uint8_t* data, size_t size, size_t from) {
+    const __m256i status = _mm256_set1_epi8(static_cast<char>(0xFF));
+    for (; from + 65 <= size; from += 64) {
+        __m256i low = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from)), status);
+        __m256i high = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + 32)), status);
+        uint64_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(low)) |
+                        (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(high))) << 32);
+        for (; mask; mask &= mask - 1) {
+            size_t pos = from + static_cast<size_t>(std::countr_zero(mask));
+            if (data[pos + 1] == 0x03 || data[pos + 1] == 0x04) return pos;
+        }
+    }
+    return findNameMetaSSE2(data, size, from);
+}
+#endif
+
+// What follows each status byte in a track: channel messages map to their data byte count
+constexpr int8_t STATUS_INVALID = -1;
+constexpr int8_t STATUS_META = -2;
+constexpr int8_t STATUS_SYSEX = -3;
+
+constexpr std::array<int8_t, 256> makeStatusTable() {
+    std::array<int8_t, 256> table{};
+    for (int status = 0; status < 256; status++) {
+        if (status < 0x80 || (status > 0xF0 && status < 0xF7) || (status > 0xF7 && status < 0xFF)) {
+            table[status] = STATUS_INVALID;
+        } else if (status == 0xFF) {
+            table[status] = STATUS_META;
+        } else if (status == 0xF0 || status == 0xF7) {
+            table[status] = STATUS_SYSEX;
+        } else {
+            table[status] = (status & 0xE0) == 0xC0 ? 1 : 2;
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<int8_t, 256> STATUS_TABLE = makeStatusTable();
+
+// One event of a track's event stream
+struct TrackEvent {
+    size_t start;        // Offset of the delta-time
+    size_t body;         // Offset just after the delta-time (the status byte, or the data under running status)
+    size_t data;         // Offset of the data bytes of a channel message, or of a meta or SysEx payload
+    size_t end;          // Offset just after the event
+    uint32_t delta;
+    uint8_t status;      // Status with running status resolved
+    uint8_t metaType;    // Meta event type when status is FF
+    bool runningStatus;  // The status byte was omitted
+};
+
+// How decoding an event ended: Truncated when the data runs out inside it, so more data may
+// still complete it; Malformed when no more data can
+enum class EventParse { Ok, Truncated, Malformed };
+
+// Read a variable-length quantity of at most four bytes at pos, single-byte ones first
+inline EventParse readVarLen(std::span<const uint8_t> data, size_t& pos, uint32_t& value) {
+    if (pos < data.size() && data[pos] < 0x80) {
+        value = data[pos++];
+        return EventParse::Ok;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (pos >= data.size()) return EventParse::Truncated;
+        uint8_t byte = data[pos++];
+        value = (value << 7) | (byte & 0x7F);
+        if (!(byte & 0x80)) return EventParse::Ok;
+    }
+    return EventParse::Malformed;
+}
+
+// Decode the event starting at offset. The one decoder behind every walk over track events: the
+// status table gives the data byte count of each status, rejects data bytes and the system common
+// and real-time statuses (F1-F6, F8-FE) that do not belong in a file, and a meta or SysEx length
+// is checked against the bytes left before it is used.
+inline EventParse nextEvent(std::span<const uint8_t> data, size_t offset, uint8_t runningStatus, TrackEvent& event) {
+    size_t pos = offset;
+    event.start = offset;
+    if (EventParse result = readVarLen(data, pos, event.delta); result != EventParse::Ok) return result;
+    if (pos >= data.size()) return EventParse::Truncated;
+    event.body = pos;
+    event.metaType = 0;
+    event.runningStatus = !(data[pos] & 0x80);
+    if (event.runningStatus) {
+        if (!runningStatus) return EventParse::Malformed;
+        event.status = runningStatus;
+    } else {
+        event.status = data[pos++];
+    }
+
+    int8_t kind = STATUS_TABLE[event.status];
+    if (kind > 0) {
+        if (data.size() - pos < static_cast<size_t>(kind)) return EventParse::Truncated;
+        if ((data[pos] & 0x80) || (kind == 2 && (data[pos + 1] & 0x80))) return EventParse::Malformed;
+        event.data = pos;
+        pos += static_cast<size_t>(kind);
+    } else if (kind == STATUS_META || kind == STATUS_SYSEX) {
+        if (kind == STATUS_META) {
+            if (pos >= data.size()) return EventParse::Truncated;
+            event.metaType = data[pos++];
+        }
+        uint32_t length;
+        if (EventParse result = readVarLen(data, pos, length); result != EventParse::Ok) return result;
+        if (data.size() - pos < length) return EventParse::Truncated;
+        event.data = pos;
+        pos += length;
+    } else {
+        return EventParse::Malformed;
+    }
+    event.end = pos;
+    return EventParse::Ok;
+}
+
+// Running status in effect after an event: channel messages set it, meta and SysEx events clear it
+inline uint8_t runningStatusAfter(const TrackEvent& event) {
+    return event.status < 0xF0 ? event.status : 0;
+}
+
+inline bool isEndOfTrack(const TrackEvent& event) {
+    return event.status == 0xFF && event.metaType == 0x2F;
+}
+
+using NameMetaFinder = size_t (*)(const uint8_t*, size_t, size_t);
+
+// Pick the widest variant the CPU supports, once
+inline NameMetaFinder selectNameMetaFinder() {
+#ifdef MIDISPLITTER_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) return findNameMetaAVX2;
+#endif
+#ifdef MIDISPLITTER_HAVE_SSE2
+    return findNameMetaSSE2;
+#else
+    return findNameMetaScalar;
+#endif
+}
+
+inline size_t findNameMeta(const uint8_t* data, size_t size, size_t from) {
+    static const NameMetaFinder finder = selectNameMetaFinder();
+    return finder(data, size, from);
+}
+
+#ifndef _WIN32
+// Owns a POSIX file descriptor and closes it on scope exit
+class FileDescriptor {
+public:
+    FileDescriptor() = default;
+    explicit FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() { reset(); }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    FileDescriptor(FileDescriptor&& other) noexcept : fd_(other.release()) {}
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept {
+        if (this != &other) {
+            reset(other.release());
+        }
+        return *this;
+    }
+
+    int get() const { return fd_; }
+    explicit operator bool() const { return fd_ >= 0; }
+
+    int release() {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+    void reset(int fd = -1) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+private:
+    int fd_ = -1;
+};
+#endif
+
+#ifdef MIDISPLITTER_HAVE_IO_URING
+// Minimal io_uring over the raw syscalls, so no liburing is needed to build
+class IoUring {
+public:
+    explicit IoUring(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+        }
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        // Each member only holds a mapping that succeeded, so unmap() releases exactly those
+        auto map = [this](size_t size, off_t offset) -> void* {
+            void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+            return mapping == MAP_FAILED ? nullptr : mapping;
+        };
+        sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = singleMmap ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqesSize_, IORING_OFF_SQES));
+        if (sqRing_ == nullptr || cqRing_ == nullptr || sqes_ == nullptr) {
+            int error = errno;
+            unmap();
+            throw std::runtime_error(std::string("Cannot map io_uring rings: ") + std::strerror(error));
+        }
+
+        auto* sq = static_cast<uint8_t*>(sqRing_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries_ = params.sq_entries;
+
+        // SQEs are always filled in ring order, so the index array is the identity
+        auto* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < sqEntries_; i++) {
+            sqArray[i] = i;
+        }
+
+        auto* cq = static_cast<uint8_t*>(cqRing_);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        localTail_ = *sqTail_;
+    }
+
+    ~IoUring() {
+        unmap();
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    unsigned capacity() const { return sqEntries_; }
+
+    // Reserve a table of direct descriptors that IORING_OP_OPENAT can fill by index
+    void registerFileSlots(unsigned count) {
+        std::vector<int> fds(count, -1);
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, fds.data(), count) < 0) {
+            throw std::runtime_error(std::string("Cannot register io_uring file table: ") + std::strerror(errno));
+        }
+    }
+
+    // Open /dev/null into direct slot 0 and close it again, on an empty ring, to check that
+    // this kernel supports what the writer relies on. Kernels that predate direct descriptors
+    // ignore file_index and return a regular descriptor instead of 0.
+    void probeDirectOpen() {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>("/dev/null");
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = 1;
+        sqe->user_data = IORING_OP_OPENAT;
+        sqe = nextSqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = 1;
+        sqe->user_data = IORING_OP_CLOSE;
+        submitAndWait();
+
+        std::string failure;
+        io_uring_cqe cqe;
+        while (nextCompletion(cqe)) {
+            if (cqe.user_data == IORING_OP_OPENAT && cqe.res > 0) {
+                ::close(cqe.res);
+                failure = "no direct descriptors";
+            } else if (cqe.res < 0 && failure.empty()) {
+                failure = std::strerror(-cqe.res);
+            }
+        }
+        if (!failure.empty()) {
+            throw std::runtime_error("Cannot open into an io_uring file slot: " + failure);
+        }
+    }
+
+    // Next free submission entry, zeroed; nullptr when the queue is full
+    io_uring_sqe* nextSqe() {
+        unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (localTail_ - head >= sqEntries_) return nullptr;
+        io_uring_sqe* sqe = &sqes_[localTail_ & sqMask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        localTail_++;
+        return sqe;
+    }
+
+    // Publish every queued entry and block until all submitted entries have completed
+    void submitAndWait() {
+        unsigned toSubmit = localTail_ - *sqTail_;
+        __atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+        inFlight_ += toSubmit;
+
+        while (toSubmit > 0 || completionsReady() < inFlight_) {
+            long ret = ::syscall(__NR_io_uring_enter, fd_, toSubmit, inFlight_, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+            toSubmit -= static_cast<unsigned>(ret);
+        }
+    }
+
+    // Pop one completion; false when none is ready
+    bool nextCompletion(io_uring_cqe& cqe) {
+        unsigned head = *cqHead_;
+        if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) return false;
+        cqe = cqes_[head & cqMask_];
+        __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+        inFlight_--;
+        return true;
+    }
+
+private:
+    unsigned completionsReady() const {
+        return __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) - *cqHead_;
+    }
+
+    void unmap() {
+        if (sqes_ != nullptr) ::munmap(sqes_, sqesSize_);
+        if (cqRing_ != nullptr && cqRing_ != sqRing_) ::munmap(cqRing_, cqRingSize_);
+        if (sqRing_ != nullptr) ::munmap(sqRing_, sqRingSize_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    int fd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    size_t sqesSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned cqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned localTail_ = 0;
+    unsigned inFlight_ = 0;
+};
+#endif
+
+// Read-only memory mapping of a whole input file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file_, &fileSize)) {
+            CloseHandle(file_);
+            throw std::runtime_error("Cannot read size of file: " + path);
+        }
+        size_ = static_cast<size_t>(fileSize.QuadPart);
+
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_ != NULL) {
+                data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            }
+            if (data_ == nullptr) {
+                if (mapping_ != NULL) CloseHandle(mapping_);
+                CloseHandle(file_);
+                throw std::runtime_error("Cannot map file into memory: " + path);
+            }
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+
+        struct stat info;
+        if (::fstat(fd_, &info) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("Cannot read size of file: " + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+
+        if (size_ > 0) {
+            void* address = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            if (address == MAP_FAILED) {
+                ::close(fd_);
+                throw std::runtime_error("Cannot map file into memory: " + path);
+            }
+            data_ = static_cast<const uint8_t*>(address);
+#ifdef MADV_HUGEPAGE
+            ::madvise(address, size_, MADV_HUGEPAGE); // Only a hint, fails harmlessly where unsupported
+#endif
+        }
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_ != nullptr) UnmapViewOfFile(data_);
+        if (mapping_ != NULL) CloseHandle(mapping_);
+        CloseHandle(file_);
+#else
+        if (data_ != nullptr) ::munmap(const_cast<uint8_t*>(data_), size_);
+        ::close(fd_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::span<const uint8_t> bytes() const { return {data_, size_}; }
+    size_t size() const { return size_; }
+
+#ifndef _WIN32
+    int fd() const { return fd_; }
+#endif
+
+    // The index pass only touches chunk headers, so keep the kernel from reading ahead
+    void adviseRandom() const {
+#ifndef _WIN32
+        advise(0, size_, MADV_RANDOM);
+#endif
+    }
+
+    // A range that is about to be consumed front to back
+    void adviseSequential(uint64_t offset, size_t length) const {
+#ifndef _WIN32
+        advise(offset, length, MADV_SEQUENTIAL);
+        advise(offset, length, MADV_WILLNEED);
+#else
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+    // A range that has been consumed and will not be needed again
+    void adviseDontNeed(uint64_t offset, size_t length) const {
+#ifndef _WIN32
+        advise(offset, length, MADV_DONTNEED);
+#else
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#else
+    void advise(uint64_t offset, size_t length, int advice) const {
+        if (data_ == nullptr || offset >= size_) return;
+        // madvise needs a page-aligned start address
+        static const uint64_t pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        uint64_t start = offset / pageSize * pageSize;
+        uint64_t end = std::min<uint64_t>(offset + length, size_);
+        ::madvise(const_cast<uint8_t*>(data_) + start, static_cast<size_t>(end - start), advice);
+    }
+
+    int fd_ = -1;
+#endif
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Output file written front to back: plain descriptor writes on POSIX, std::ofstream on Windows
+class OutputFile {
+public:
+    explicit OutputFile(const fs::path& path) : path_(path) {
+#ifdef _WIN32
+        stream_.open(path, std::ios::binary);
+        if (!stream_) {
+            throw std::runtime_error("Cannot create output file: " + path.string());
+        }
+#else
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot create output file: " + path.string());
+        }
+#endif
+    }
+
+    // An output that was never closed is incomplete (an exception is on its way), so it is
+    // removed rather than left truncated
+    ~OutputFile() {
+#ifdef _WIN32
+        if (!stream_.is_open()) return;
+        stream_.close();
+#else
+        if (fd_ < 0) return;
+        ::close(fd_);
+#endif
+        std::error_code error;
+        fs::remove(path_, error);
+    }
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    void write(const uint8_t* data, size_t size) {
+#ifdef _WIN32
+        stream_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!stream_) {
+            throw std::runtime_error("Error writing to output file: " + path_.string());
+        }
+#else
+        writeAll(fd_, data, size);
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        stream_.close();
+        bool closed = static_cast<bool>(stream_);
+#else
+        int fd = fd_;
+        fd_ = -1;
+        bool closed = ::close(fd) == 0;
+#endif
+        if (!closed) {
+            std::error_code error;
+            fs::remove(path_, error);
+            throw std::runtime_error("Error closing output file: " + path_.string());
+        }
+    }
+
+    // Overwrite bytes already written, e.g. a length field, leaving the write position at the end
+    void writeAt(uint64_t offset, const uint8_t* data, size_t size) {
+#ifdef _WIN32
+        std::streampos end = stream_.tellp();
+        stream_.seekp(static_cast<std::streamoff>(offset));
+        stream_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        stream_.seekp(end);
+        if (!stream_) {
+            throw std::runtime_error("Error writing to output file: " + path_.string());
+        }
+#else
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd_, data, size, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("Error writing to output file: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+#endif
+    }
+
+    // Reserve the final size of the file up front (Linux only)
+    void preallocate(uint64_t size) {
+#ifdef __linux__
+        preallocateOutput(fd_, size, path_);
+#else
+        (void)size;
+#endif
+    }
+
+#ifndef _WIN32
+    int fd() const { return fd_; }
+#endif
+
+private:
+    fs::path path_;
+#ifdef _WIN32
+    std::ofstream stream_;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Buffered reader that decodes an event stream with nextEvent: reads at most `limit` bytes from
+// the stream in blocks of bufferSize bytes, and grows the buffer for an event larger than it
+class StreamReader {
+public:
+    StreamReader(std::istream& in, uint64_t limit, size_t bufferSize = BUFFER_SIZE)
+        : in_(in), remaining_(limit), buffer_(bufferSize) {}
+
+    // Decode the next event; on success bytes holds it from its delta-time on, with the offsets
+    // in event relative to bytes, valid until the next call. Truncated at the end of the data.
+    EventParse next(uint8_t runningStatus, TrackEvent& event, std::span<const uint8_t>& bytes) {
+        while (true) {
+            std::span<const uint8_t> window(buffer_.data() + pos_, filled_ - pos_);
+            EventParse result = nextEvent(window, 0, runningStatus, event);
+            if (result == EventParse::Ok) {
+                bytes = window.first(event.end);
+                pos_ += event.end;
+                return result;
+            }
+            if (result == EventParse::Malformed || !refill()) return result;
+        }
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    // Keep the unread bytes, moved to the front, and read more after them
+    bool refill() {
+        if (remaining_ == 0) return false;
+        std::memmove(buffer_.data(), buffer_.data() + pos_, filled_ - pos_);
+        filled_ -= pos_;
+        pos_ = 0;
+        if (filled_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        in_.read(reinterpret_cast<char*>(buffer_.data() + filled_),
+                 static_cast<std::streamsize>(std::min<uint64_t>(remaining_, buffer_.size() - filled_)));
+        size_t got = static_cast<size_t>(in_.gcount());
+        remaining_ -= got;
+        if (got == 0) remaining_ = 0;
+        filled_ += got;
+        return got > 0;
+    }
+
+    std::istream& in_;
+    uint64_t remaining_;
+    std::vector<uint8_t> buffer_;
+    size_t pos_ = 0;
+    size_t filled_ = 0;
+};
+
+// Reads an input ahead on a thread of its own, so reading the input overlaps with writing the
+// outputs instead of alternating with it; this buffer's consumer stays the only writer. Blocks
+// are handed over through a single-producer/single-consumer ring without locks: the reader
+// thread only advances head_, the consumer only advances tail_, and each side sleeps on the
+// other's counter when the ring is full or empty. An empty block marks the end of the input.
+// Seeking is not supported, so skips read through.
+//
+// Outside Windows the input is a descriptor read with read(2) after poll() has seen it ready,
+// together with a pipe that the destructor writes to, so a reader waiting on a pipe or terminal
+// that sends nothing more is woken and the destructor does not hang in join(). On Windows the
+// input is a stream, which the reader may stay blocked in until it delivers data or ends.
+class ReadAheadBuffer : public std::streambuf {
+public:
+#ifdef _WIN32
+    explicit ReadAheadBuffer(std::istream& source, size_t blockSize = 1 << 20, size_t blockCount = 8)
+        : source_(source), blocks_(blockCount) {
+        start(blockSize);
+    }
+#else
+    // fd stays owned by the caller and must outlive the buffer
+    explicit ReadAheadBuffer(int fd, size_t blockSize = 1 << 20, size_t blockCount = 8)
+        : fd_(fd), blocks_(blockCount) {
+        int wake[2];
+        if (::pipe(wake) != 0) {
+            throw std::runtime_error(std::string("Cannot create pipe: ") + std::strerror(errno));
+        }
+        wakeRead_.reset(wake[0]);
+        wakeWrite_.reset(wake[1]);
+        ::fcntl(wake[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(wake[1], F_SETFD, FD_CLOEXEC);
+        start(blockSize);
+    }
+#endif
+
+    ~ReadAheadBuffer() override {
+        // Make room in the ring so a reader waiting for space wakes up and sees stop_
+        stop_ = true;
+        tail_.fetch_add(blocks_.size(), std::memory_order_release);
+        tail_.notify_one();
+#ifndef _WIN32
+        // And wake a reader waiting for input
+        char byte = 0;
+        while (::write(wakeWrite_.get(), &byte, 1) < 0 && errno == EINTR) {}
+#endif
+        reader_.join();
+    }
+
+    ReadAheadBuffer(const ReadAheadBuffer&) = delete;
+    ReadAheadBuffer& operator=(const ReadAheadBuffer&) = delete;
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        if (ended_) return traits_type::eof();
+
+        // Hand the block just read back to the reader
+        if (holding_) {
+            tail_.store(++consumed_, std::memory_order_release);
+            tail_.notify_one();
+            holding_ = false;
+        }
+
+        uint64_t head = head_.load(std::memory_order_acquire);
+        while (head == consumed_) {
+            head_.wait(head, std::memory_order_acquire);
+            head = head_.load(std::memory_order_acquire);
+        }
+
+        Block& block = blocks_[consumed_ % blocks_.size()];
+        if (block.size == 0) {
+            ended_ = true;
+            return traits_type::eof();
+        }
+        holding_ = true;
+        setg(block.data.data(), block.data.data(), block.data.data() + block.size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    struct Block {
+        std::vector<char> data;
+        size_t size = 0;
+    };
+
+    void start(size_t blockSize) {
+        for (auto& block : blocks_) {
+            block.data.resize(blockSize);
+        }
+        reader_ = std::thread([this] { readLoop(); });
+    }
+
+    // Fill block from the input; 0 at its end, after a read error or when stopped
+    size_t readBlock(Block& block) {
+#ifdef _WIN32
+        try {
+            source_.read(block.data.data(), static_cast<std::streamsize>(block.data.size()));
+            return static_cast<size_t>(source_.gcount());
+        } catch (const std::exception&) {
+            return 0;
+        }
+#else
+        while (true) {
+            pollfd ready[2] = {{fd_, POLLIN, 0}, {wakeRead_.get(), POLLIN, 0}};
+            if (::poll(ready, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                return 0;
+            }
+            if (ready[1].revents != 0) return 0;
+
+            ssize_t length = ::read(fd_, block.data.data(), block.data.size());
+            if (length < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            return length > 0 ? static_cast<size_t>(length) : 0;
+        }
+#endif
+    }
+
+    void readLoop() {
+        uint64_t head = 0;
+        while (true) {
+            uint64_t tail = tail_.load(std::memory_order_acquire);
+            while (head - tail == blocks_.size()) {
+                tail_.wait(tail, std::memory_order_acquire);
+                tail = tail_.load(std::memory_order_acquire);
+            }
+            if (stop_) return;
+
+            // A read error ends the input like the end of the data does
+            Block& block = blocks_[head % blocks_.size()];
+            block.size = readBlock(block);
+            head_.store(++head, std::memory_order_release);
+            head_.notify_one();
+            if (block.size == 0) return;
+        }
+    }
+
+#ifdef _WIN32
+    std::istream& source_;
+#else
+    int fd_;
+    FileDescriptor wakeRead_;       // A pipe the destructor writes to, to stop a reader waiting for input
+    FileDescriptor wakeWrite_;
+#endif
+    std::vector<Block> blocks_;
+    std::atomic<uint64_t> head_{0}; // Blocks filled by the reader
+    std::atomic<uint64_t> tail_{0}; // Blocks released by the consumer
+    std::atomic<bool> stop_{false};
+    uint64_t consumed_ = 0;         // Consumer side: index of the block being read
+    bool holding_ = false;
+    bool ended_ = false;
+    std::thread reader_;
+};
+
+// Keeps the page cache used by one sequential copy bounded. Once a window of data has been
+// copied, writeback of it is started; the window before it is then waited for and dropped
+// from the cache on both the input and the output, so at most two windows stay resident.
+class PageCacheWindow {
+public:
+    // inFd may be -1 (or a pipe) when only the output should be managed
+    PageCacheWindow(size_t windowSize, int inFd, uint64_t inOffset, int outFd, uint64_t outOffset,
+                    const MappedFile* mapping = nullptr)
+        : windowSize_(windowSize), inFd_(inFd), outFd_(outFd), mapping_(mapping),
+          inFirst_(inOffset), outFirst_(outOffset), inDone_(inOffset), outDone_(outOffset), inStarted_(inOffset), outStarted_(outOffset),
+          inPosition_(inOffset), outPosition_(outOffset) {
+#ifdef __linux__
+        if (inFd_ >= 0) {
+            ::posix_fadvise(inFd_, static_cast<off_t>(inOffset), 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    size_t windowSize() const { return windowSize_; }
+
+    // Record that bytes more have been copied past the current cursor
+    void advance(size_t bytes) {
+        inPosition_ += bytes;
+        outPosition_ += bytes;
+        if (outPosition_ - outStarted_ < windowSize_) return;
+
+#ifdef __linux__
+        // Start writeback of the window just completed without waiting for it
+        ::sync_file_range(outFd_, static_cast<off_t>(outStarted_), static_cast<off_t>(outPosition_ - outStarted_),
+                          SYNC_FILE_RANGE_WRITE);
+#endif
+        // The window before it has had a whole window's time to reach the disk
+        drop(inStarted_, outStarted_);
+        inStarted_ = inPosition_;
+        outStarted_ = outPosition_;
+    }
+
+    // Flush and drop everything copied so far
+    void finish() {
+        drop(inPosition_, outPosition_);
+    }
+
+private:
+    void drop(uint64_t inEnd, uint64_t outEnd) {
+        if (outEnd <= outDone_) return;
+#ifdef __linux__
+        ::sync_file_range(outFd_, static_cast<off_t>(outDone_), static_cast<off_t>(outEnd - outDone_),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        // Large folios are only dropped when they lie wholly inside the advised range, so every
+        // drop covers everything since the start of the copy rather than just the last window
+        ::posix_fadvise(outFd_, static_cast<off_t>(outFirst_), static_cast<off_t>(outEnd - outFirst_), POSIX_FADV_DONTNEED);
+        if (inFd_ >= 0) {
+            ::posix_fadvise(inFd_, static_cast<off_t>(inFirst_), static_cast<off_t>(inEnd - inFirst_), POSIX_FADV_DONTNEED);
+        }
+#endif
+        if (mapping_ != nullptr) {
+            mapping_->adviseDontNeed(inDone_, static_cast<size_t>(inEnd - inDone_));
+        }
+        inDone_ = inEnd;
+        outDone_ = outEnd;
+    }
+
+    size_t windowSize_;
+    int inFd_;
+    int outFd_;
+    const MappedFile* mapping_;
+    uint64_t inFirst_, outFirst_;       // Where the copy started
+    uint64_t inDone_, outDone_;         // Everything before these has been dropped
+    uint64_t inStarted_, outStarted_;   // Writeback has been started up to these
+    uint64_t inPosition_, outPosition_; // Copy cursor
+};
+
+// Fixed-size buffers aligned for O_DIRECT, recycled across tracks and shared by writer threads
+class AlignedBufferPool {
+public:
+    AlignedBufferPool(size_t bufferSize, size_t alignment) : bufferSize_(bufferSize), alignment_(alignment) {}
+
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    struct FreeDeleter {
+        void operator()(uint8_t* buffer) const { std::free(buffer); }
+    };
+    using Buffer = std::unique_ptr<uint8_t, FreeDeleter>;
+
+    // A buffer on loan from the pool, handed back when it goes out of scope
+    class Lease {
+    public:
+        Lease(AlignedBufferPool& pool, Buffer buffer) : pool_(pool), buffer_(std::move(buffer)) {}
+        ~Lease() { pool_.release(std::move(buffer_)); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        uint8_t* data() const { return buffer_.get(); }
+        size_t size() const { return pool_.bufferSize_; }
+
+    private:
+        AlignedBufferPool& pool_;
+        Buffer buffer_;
+    };
+
+    Lease acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                Buffer buffer = std::move(free_.back());
+                free_.pop_back();
+                return Lease(*this, std::move(buffer));
+            }
+        }
+        auto* memory = static_cast<uint8_t*>(std::aligned_alloc(alignment_, bufferSize_));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return Lease(*this, Buffer(memory));
+    }
+
+    size_t alignment() const { return alignment_; }
+
+private:
+    void release(Buffer buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(buffer));
+    }
+
+    size_t bufferSize_;
+    size_t alignment_;
+    std::mutex mutex_;
+    std::vector<Buffer> free_;
+};
+
+class BatchSplitter;
+
+class MIDISplitter {
+private:
+    // The library interface (midisplitter.h) is built on the indexing below, the batch and watch
+    // modes of the command line tool on the split planning
+    friend class midisplitter::MidiFile;
+    friend class BatchSplitter;
+    friend void benchmarkNameSearch();
+
+    // Progress messages and notes go here: the console unless another stream is given
+    std::ostream& log_;
+
+    struct TrackInfo {
+        uint16_t number;
+        std::string name;
+        uint64_t size;          // Length of the event data: the MTrk length, unless it had to be recovered
+        uint32_t declaredSize;  // Length given in the MTrk header
+        uint64_t position; // Offset of the MTrk chunk header in the input file
+        std::string instrument;  // First instrument name (FF 04) before the first non-zero delta-time
+        int16_t program = -1;    // First program change there, -1 when there is none
+        uint16_t channels = 0;   // Bit n set when channel n + 1 is used there
+
+        // The MTrk header is wrong (wrapped above 4 GB or corrupt), so outputs get a new one
+        bool recovered() const { return size != declaredSize; }
+    };
+
+    // Convert big-endian bytes to uint32_t
+    uint32_t bytesToUInt32(std::span<const uint8_t> bytes, size_t offset = 0);
+
+    // Convert big-endian bytes to uint16_t
+    uint16_t bytesToUInt16(std::span<const uint8_t> bytes, size_t offset = 0);
+
+    // Convert big-endian bytes to uint64_t
+    uint64_t bytesToUInt64(std::span<const uint8_t> bytes, size_t offset = 0);
+
+    // Convert uint64_t to big-endian bytes
+    std::vector<uint8_t> uint64ToBytes(uint64_t value);
+
+    // Convert uint32_t to big-endian bytes
+    std::vector<uint8_t> uint32ToBytes(uint32_t value);
+
+    // Convert uint16_t to big-endian bytes
+    std::vector<uint8_t> uint16ToBytes(uint16_t value);
+
+    // Leading bytes of a track's event data searched for a name pattern when its events cannot
+    // be walked; also the first read of a streamed track's lead-in, which grows from there
+    static constexpr size_t NAME_SEARCH_WINDOW = 1024;
+
+    // Offset of the first usable FF 03 (track name) meta event in the window, or of the first
+    // usable FF 04 (instrument name) when there is no track name; the window size if neither
+    size_t locateNameMeta(std::span<const uint8_t> window);
+
+    // Extract track name from the start of the track's event data
+    std::string extractTrackName(std::span<const uint8_t> trackData, uint16_t trackNumber);
+
+    // Get safe filename
+    std::string getSafeFilename(const std::string& name);
+
+    struct MIDIHeader {
+        uint16_t format;
+        uint16_t trackCount;
+        uint16_t division;
+    };
+
+    // Validate the 14-byte MThd chunk
+    MIDIHeader parseHeader(std::span<const uint8_t> headerData);
+
+    // Check an 8-byte chunk header and return the MTrk length
+    uint32_t parseTrackHeader(std::span<const uint8_t> trackHeader, uint16_t trackNumber);
+
+    // Prepare output header for Format 1 (single track), or for a conductor track followed by the
+    // track when conductor holds a complete MTrk chunk
+    std::vector<uint8_t> buildOutputHeader(uint16_t division, std::span<const uint8_t> conductor = {});
+
+    // Track 1 can be this large and still be read whole as a conductor source in a stream split
+    static constexpr uint64_t MAX_STREAM_CONDUCTOR_SOURCE = 256 << 20;
+
+    // Build a conductor MTrk chunk from the tempo (FF 51), time signature (FF 58) and key
+    // signature (FF 59) events of a track, at their original ticks. Everything else is dropped;
+    // the walk stops at End of Track or at the first event that does not parse. Returns an empty
+    // vector when the track has none of these events.
+    std::vector<uint8_t> extractConductor(std::span<const uint8_t> trackData);
+
+    // The two output headers of a split: track 1 (and every track without a conductor) gets a
+    // plain single-track header, the others the header carrying the cached conductor chunk
+    struct OutputHeaders {
+        std::vector<uint8_t> single;
+        std::vector<uint8_t> withConductor; // Empty unless a conductor is embedded
+
+        const std::vector<uint8_t>& forTrack(const TrackInfo& track) const {
+            return (withConductor.empty() || track.number == 1) ? single : withConductor;
+        }
+    };
+
+    // Build the output headers, with a conductor taken from track 1's data when it is requested
+    OutputHeaders buildOutputHeaders(uint16_t division, std::span<const uint8_t> firstTrack, const SplitOptions& options);
+
+    // Notes sounding during a walk, so a cut can close them and the next part reopen them, and the
+    // channel state (controllers, program, pitch bend) the next part has to restore
+    struct SoundingNotes {
+        std::array<uint16_t, 16 * 128> count{};   // Per channel and key; overlapping notes stack
+        std::array<uint8_t, 16 * 128> velocity{}; // Velocity of the latest note-on
+        uint32_t keys = 0;                        // Channel/key pairs with count > 0
+
+        // Per channel: controllers 0-119 (120-127 are channel mode messages, not state), then the
+        // program, then the pitch bend. order is when a slot was last set, 0 when it never was.
+        static constexpr size_t STATE_SLOTS = 130;
+        static constexpr size_t PROGRAM_SLOT = 128;
+        static constexpr size_t PITCH_BEND_SLOT = 129;
+        std::array<std::array<uint8_t, 2>, 16 * STATE_SLOTS> value{};
+        std::array<uint64_t, 16 * STATE_SLOTS> order{};
+        uint64_t changes = 0;
+
+        // Change in keys if the channel message were applied
+        int keyDelta(uint8_t status, const uint8_t* data) const {
+            uint8_t type = status & 0xF0;
+            size_t slot = (status & 0x0F) * 128 + data[0];
+            if (type == 0x90 && data[1] != 0) return count[slot] == 0 ? 1 : 0;
+            if ((type == 0x80 || type == 0x90) && count[slot] == 1) return -1;
+            return 0;
+        }
+
+        void apply(uint8_t status, const uint8_t* data) {
+            uint8_t type = status & 0xF0;
+            size_t slot = (status & 0x0F) * 128 + data[0];
+            if (type == 0x90 && data[1] != 0) {
+                if (count[slot]++ == 0) keys++;
+                velocity[slot] = data[1];
+            } else if ((type == 0x80 || type == 0x90) && count[slot] > 0) {
+                if (--count[slot] == 0) keys--;
+            } else if (type >= 0xB0 && type != 0xD0) {
+                applyState(status, data);
+            }
+        }
+
+        void applyState(uint8_t status, const uint8_t* data) {
+            uint8_t type = status & 0xF0;
+            size_t channel = (status & 0x0F) * STATE_SLOTS;
+            if (type == 0xB0 && data[0] < 120) {
+                value[channel + data[0]] = {data[0], data[1]};
+                order[channel + data[0]] = ++changes;
+            } else if (type == 0xB0 && data[0] == 121) {
+                // Reset All Controllers: nothing before it needs restoring
+                std::fill_n(order.begin() + channel, 120, 0);
+                order[channel + PITCH_BEND_SLOT] = 0;
+            } else if (type == 0xC0) {
+                value[channel + PROGRAM_SLOT] = {data[0], 0};
+                order[channel + PROGRAM_SLOT] = ++changes;
+            } else if (type == 0xE0) {
+                value[channel + PITCH_BEND_SLOT] = {data[0], data[1]};
+                order[channel + PITCH_BEND_SLOT] = ++changes;
+            }
+        }
+    };
+
+    // Bytes of the note-off per sounding key plus End of Track that close a part
+    static constexpr size_t PART_CLOSE_BYTES_PER_KEY = 4;
+    static constexpr size_t END_OF_TRACK_BYTES = 4;
+
+    // State of a walk over whole events, see walkEvents
+    struct EventWalk {
+        size_t pos = 0;             // Offset just after the last event walked
+        uint64_t ticks = 0;         // Sum of the delta-times walked
+        uint8_t runningStatus = 0;
+        bool ended = false;         // Stopped after End of Track
+        bool malformed = false;     // Stopped at an event that does not parse
+    };
+
+    // Advance walk over the events that end at or before limit, stopping after End of Track or
+    // before an event that runs past limit. With notes, sounding notes are tracked and an event
+    // only counts as fitting when the note-offs and End of Track needed to close a part after it
+    // fit as well.
+    void walkEvents(std::span<const uint8_t> data, size_t limit, EventWalk& walk, SoundingNotes* notes = nullptr);
+
+    // Length of the event data up to and including the End of Track event, or data.size() + 1
+    // when the events stop parsing first
+    size_t findEndOfTrack(std::span<const uint8_t> data);
+
+    // Upper bound on the lead-in (events before the first non-zero delta-time) walked for metadata
+    static constexpr size_t MAX_METADATA_SCAN = 1 << 20;
+
+    struct TrackMetadata {
+        std::string name;
+        std::string instrument;
+        int16_t program = -1;
+        uint16_t channels = 0;
+        bool truncated = false; // Data ran out before the lead-in ended
+        bool malformed = false; // Events could not be parsed, so nothing after this point is trusted
+    };
+
+    // Walk the events at the start of a track up to its first non-zero delta-time (or End of Track),
+    // following delta-time VLQs, running status and the VLQ lengths of meta and SysEx events
+    TrackMetadata readTrackMetadata(std::span<const uint8_t> trackData);
+
+    // Fill in a track's name and metadata. The name is the track name meta event, else the instrument
+    // name; when the events cannot be walked the old pattern search over the first bytes is the fallback.
+    void describeTrack(TrackInfo& track, const TrackMetadata& meta, std::span<const uint8_t> trackData);
+
+    void printTrackInfo(const TrackInfo& track);
+
+    // Output file for a track, numbering copies so existing files are never overwritten
+    // or any path in taken (outputs planned but not created yet). For a track that will be
+    // cut into parts, the part files of the name must be free as well; partOwners holds the
+    // outputs of the folder that have part files (see partFileOwners).
+    fs::path makeOutputPath(const std::string& outputDir, const std::string& baseName, const std::string& trackName,
+                            const std::set<fs::path>& taken = {}, uint64_t parts = 0,
+                            const std::set<fs::path>& partOwners = {});
+
+    // Fail before any output is created when the output filesystem cannot hold the whole split
+    void checkFreeSpace(const std::string& outputDir, uint64_t requiredBytes, size_t fileCount);
+
+public:
+    // Output paths chosen by the splits of a batch that are running at the same time, passed to
+    // planSplit and splitMIDIFile
+    struct PlannedOutputs {
+        std::mutex mutex;
+        std::set<fs::path> paths;
+    };
+
+private:
+
+    // Outputs in outputDir that part files of an earlier split belong to, whatever their number:
+    // "<name> (part N).mid" gives "<name>.mid". Scanned once per planning pass, so choosing the
+    // names of many cut tracks does not list the folder again for each candidate.
+    std::set<fs::path> partFileOwners(const std::string& outputDir);
+
+    // Whether the parts of outputPath are planned (the first parts of them), or any part file of
+    // that name is left in the folder by an earlier split (partOwners, from partFileOwners)
+    bool partPathsInUse(const fs::path& outputPath, uint64_t parts, const std::set<fs::path>& taken,
+                        const std::set<fs::path>& partOwners);
+
+    // Output names chosen one at a time while a split runs (the channels of a Format 0 file, the
+    // tracks of a stream). Each name is chosen and reserved under the lock of planned, when given,
+    // so splits running at the same time on a pool never pick the same one; the names are
+    // released when the split is over, by which time their files exist.
+    class OutputReservations {
+    public:
+        OutputReservations(MIDISplitter& splitter, PlannedOutputs* planned) : splitter_(splitter), planned_(planned) {}
+
+        ~OutputReservations() {
+            if (planned_ == nullptr) return;
+            std::lock_guard<std::mutex> lock(planned_->mutex);
+            for (const auto& path : own_) {
+                planned_->paths.erase(path);
+            }
+        }
+
+        OutputReservations(const OutputReservations&) = delete;
+        OutputReservations& operator=(const OutputReservations&) = delete;
+
+        fs::path reserve(const std::string& outputDir, const std::string& baseName, const std::string& trackName) {
+            std::unique_lock<std::mutex> lock;
+            if (planned_ != nullptr) {
+                lock = std::unique_lock<std::mutex>(planned_->mutex);
+            }
+            std::set<fs::path>& taken = planned_ != nullptr ? planned_->paths : own_;
+            fs::path path = splitter_.makeOutputPath(outputDir, baseName, trackName, taken);
+            taken.insert(path);
+            own_.insert(path);
+            return path;
+        }
+
+    private:
+        MIDISplitter& splitter_;
+        PlannedOutputs* planned_;
+        std::set<fs::path> own_;
+    };
+
+    // Choose every output name up front so tracks can be written in any order. Tracks that will
+    // be cut get a name whose part files are free, and their expected part paths are returned
+    // in partPaths. When planned is given, its paths are avoided as well and the new ones, parts
+    // included, are added to it.
+    std::vector<fs::path> planOutputPaths(const std::string& outputDir, const std::string& baseName,
+                                          const std::vector<TrackInfo>& tracks, const OutputHeaders& headers,
+                                          const SplitOptions& options, std::vector<fs::path>& partPaths,
+                                          PlannedOutputs* planned = nullptr);
+
+    // Buffer size for copying a track: large enough that big tracks take few syscalls,
+    // small enough that short tracks do not allocate megabytes, and never above the cache window
+    size_t chooseBufferSize(uint64_t size, size_t cacheWindow);
+
+    // Copy data from a stream to an output file in chunks
+    void copyStream(std::istream& in, OutputFile& out, size_t size, std::vector<char>& buffer,
+                    PageCacheWindow* window = nullptr);
+
+    // Bytes of the MTrk chunk (header and data) actually present in the input,
+    // so a truncated last track is copied as far as it goes
+    size_t trackByteCount(const MappedFile& input, const TrackInfo& track);
+
+    // An MTrk length is 32 bits, so longer tracks are written as several part files
+    static constexpr uint64_t MAX_MTRK_SIZE = 0xFFFFFFFF;
+
+    // Output path of one part of a track written as several files: "<name> (part N).mid"
+    fs::path makePartPath(const fs::path& outputPath, unsigned part);
+
+    // Append a delta-time as a VLQ; times beyond the 28-bit VLQ range are reached through
+    // empty text events at the largest delta
+    void appendDeltaTime(std::vector<uint8_t>& out, uint64_t ticks);
+
+    void writeChunkHeader(OutputFile& out, uint64_t size);
+
+    // Largest MTrk data length of one output: the 32-bit limit, or what the part size leaves
+    uint64_t maxChunkSize(const std::vector<uint8_t>& outputHeader, const SplitOptions& options);
+
+    // Track name and instrument name meta events at delta-time 0, for the start of a part
+    void appendPartNames(std::vector<uint8_t>& out, const TrackMetadata& meta);
+
+    // Channel messages that bring every channel back to the state recorded in notes, in the order
+    // the values were set, so bank selects stay before their program change and RPN/NRPN selects
+    // before their data entry. The first message gets delta; delta is 0 after any message.
+    void appendChannelState(std::vector<uint8_t>& out, const SoundingNotes& notes, uint64_t& delta);
+
+    // Tracks that cannot be copied as they are: recovered ones need a new header, oversized ones parts
+    bool needsRewrite(const TrackInfo& track, const std::vector<uint8_t>& outputHeader, const SplitOptions& options);
+
+    // Number of part files a track will be cut into, 0 when it fits in one output. The exact count
+    // is only known once the events have been walked; this is the least it can be.
+    uint64_t expectedPartCount(const TrackInfo& track, const std::vector<uint8_t>& outputHeader, const SplitOptions& options);
+
+    // Write a track with a fresh MTrk header, cut at event boundaries into parts of at most
+    // maxChunkSize bytes of event data when it is larger. Each part plays on its own: notes
+    // sounding at a cut get a note-off at the end of the part (before an appended End of Track)
+    // and a note-on again at the start of the next, whose first event is re-timed to its absolute
+    // position and gets its status byte back. Parts are written straight from the mapping after
+    // the events of each have been walked once. Returns the number of parts written, 0 when the
+    // track went to outputPath whole.
+    unsigned writeRewrittenTrack(const MappedFile& input, const fs::path& outputPath, const std::vector<uint8_t>& outputHeader,
+                             const TrackInfo& track, const SplitOptions& options);
+
+#ifdef __linux__
+    // Copy a byte range of the mapped input to a file inside the kernel.
+    // Tries copy_file_range first, then sendfile, then writes straight from the mapping.
+    void copyFileRange(const MappedFile& input, int outFd, uint64_t offset, size_t size);
+
+    // Build an unknown chunk that SMF readers skip, used purely as padding
+    std::vector<uint8_t> makePaddingChunk(size_t payloadSize);
+
+    // Outcome of the clone probe per pair of input and output filesystems (st_dev), see
+    // cloneSupported. Shared by every splitter, so batch and watch mode probe each pair once;
+    // a pair is marked refused when a clone fails after its probe succeeded.
+    static inline std::map<std::pair<dev_t, dev_t>, bool> cloneProbes;
+    static inline std::mutex cloneProbeMutex;
+
+    // The filesystems of the input and an output, or nothing when either cannot be stat'ed
+    static std::optional<std::pair<dev_t, dev_t>> cloneDevices(const MappedFile& input, int outFd);
+
+    // Whether blocks of the input can be cloned into the output, probed once per pair of
+    // filesystems (FICLONERANGE only works within one reflink-capable filesystem) by cloning the
+    // block at sourceOffset into the still empty output, which is then emptied again
+    bool cloneSupported(const MappedFile& input, int outFd, off_t sourceOffset, size_t blockSize);
+
+    // Stop padding outputs of this pair of filesystems after a clone failed despite the probe
+    static void markCloneRefused(const MappedFile& input, int outFd);
+
+    // Share the block-aligned middle of [offset, offset + size) with the output via FICLONERANGE,
+    // byte-copying only the unaligned head and tail. The output's file position must already be
+    // congruent to offset modulo blockSize. Returns false if the filesystem refused to clone.
+    bool cloneFileRange(const MappedFile& input, int outFd, off_t offset, size_t size, size_t blockSize);
+
+    // O_DIRECT needs buffer addresses, file offsets and lengths aligned to the logical block size
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+    static constexpr size_t DIRECT_IO_BUFFER_SIZE = 4 << 20;
+    // Shared by every splitter, so batch and watch mode reuse the buffers from file to file
+    static inline AlignedBufferPool directBuffers{DIRECT_IO_BUFFER_SIZE, DIRECT_IO_ALIGNMENT};
+
+    void pwriteAll(int fd, const uint8_t* data, size_t size, off_t offset);
+
+    // Write header and track with O_DIRECT: the output is assembled in pooled aligned buffers and
+    // written in whole blocks; the unaligned tail goes through a final buffered write and ftruncate
+    // pins the exact size. Returns false if the filesystem does not support O_DIRECT.
+    bool writeTrackFileDirect(const MappedFile& input, const fs::path& outputPath,
+                              const std::vector<uint8_t>& outputHeader, const TrackInfo& track);
+
+    // Create one output file holding the given header followed by the track's MTrk chunk.
+    // Returns the number of part files written instead, 0 when the output is outputPath.
+    unsigned writeTrackFile(const MappedFile& input, const fs::path& outputPath, const std::vector<uint8_t>& outputHeader,
+                            const TrackInfo& track, const SplitOptions& options);
+
+#else
+    // Create one output file holding the given header followed by the track's MTrk chunk.
+    // Returns the number of part files written instead, 0 when the output is outputPath.
+    unsigned writeTrackFile(const MappedFile& input, const fs::path& outputPath, const std::vector<uint8_t>& outputHeader,
+                            const TrackInfo& track, const SplitOptions& options);
+#endif
+
+    // Set by any writer whose filesystem refused FICLONERANGE or O_DIRECT, reported once after the split
+    std::atomic<bool> reflinkRefused{false};
+    std::atomic<bool> directRefused{false};
+
+    // parts: what writeTrackFile returned for the track
+    void printSplitResult(const TrackInfo& track, const fs::path& outputPath, unsigned parts);
+
+    // Write the tracks on a bounded pool of workers. Each worker claims the next unwritten track;
+    // all input access is offset-based, so the workers share the mapping without coordination.
+    // Progress is printed by the calling thread strictly in track order.
+    int writeTracksParallel(const MappedFile& input, const std::vector<TrackInfo>& tracks,
+                            const std::vector<fs::path>& outputPaths, const OutputHeaders& headers,
+                            const SplitOptions& options, unsigned jobs);
+
+    struct TrackStats {
+        uint64_t events = 0;
+        uint64_t notes = 0;         // Note-ons with a non-zero velocity
+        uint64_t ticks = 0;         // Sum of the delta-times, i.e. the track length in ticks
+        uint32_t maxPolyphony = 0;  // Most notes sounding at once
+        uint16_t channels = 0;      // Bit n set when channel n + 1 is used
+        bool malformed = false;     // Decoding stopped at an event that could not be parsed
+    };
+
+    // Decode a whole track's event stream
+    TrackStats decodeTrackStats(std::span<const uint8_t> trackData);
+
+    // Decode every track on a pool of jobs threads, biggest tracks first so one huge track
+    // does not start last and leave the other threads idle
+    std::vector<TrackStats> collectTrackStats(const MappedFile& input, const std::vector<TrackInfo>& tracks, unsigned jobs);
+
+    // Whether a track passes the --tracks, --name-regex and --min-size/--max-size selectors
+    bool trackSelected(const TrackInfo& track, const SplitOptions& options, const std::regex& nameRegex);
+
+    // Apply the selectors to a track table
+    void selectTracks(std::vector<TrackInfo>& tracks, const SplitOptions& options);
+
+    // Read the start of a track from a stream into leadIn, reading further until its lead-in has
+    // been walked (up to MAX_METADATA_SCAN); the stream is left just after the bytes read
+    TrackMetadata readLeadIn(std::istream& in, uint32_t trackSize, std::vector<uint8_t>& leadIn);
+
+    // Move a stream forward, seeking where possible and reading through pipes
+    void skipStream(std::istream& in, uint64_t count);
+
+    // JSON string literal; names that are not valid UTF-8 (Latin-1, Shift-JIS, ...) are
+    // passed through byte by byte as U+0080-U+00FF so the output always parses
+    std::string jsonString(const std::string& text);
+
+    // A single-track output written event by event (the channel outputs of a Format 0 split, a
+    // merged track). Events are re-timed against the output's own previous event and gathered in
+    // a buffer that is written out whenever it fills; the MTrk length is filled in on close.
+    struct TrackOutput {
+        std::unique_ptr<OutputFile> file;
+        fs::path path;
+        std::vector<uint8_t> buffer;
+        uint64_t lastTick = 0;
+        uint64_t trackBytes = 0;   // MTrk data written to the file so far
+        uint64_t events = 0;
+        uint8_t runningStatus = 0;
+    };
+
+    static constexpr size_t TRACK_OUTPUT_BUFFER_SIZE = 256 << 10;
+
+    void openTrackOutput(TrackOutput& output, const fs::path& path, const std::vector<uint8_t>& outputHeader);
+
+    void flushTrackOutput(TrackOutput& output);
+
+    // Append an event (status byte first) at an absolute tick; status is 0 for meta and SysEx
+    // events, which also end running status in the output
+    void appendTrackEvent(TrackOutput& output, uint64_t tick, std::span<const uint8_t> event, uint8_t status);
+
+    // End the track with End of Track at tick, write out the rest and fill in the MTrk length
+    void closeTrackOutput(TrackOutput& output, uint64_t tick, size_t headerSize);
+
+    // An event decoded from a stream: absolute tick, resolved status and its bytes, status first
+    struct StreamEvent {
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        uint8_t metaType = 0;
+        std::vector<uint8_t> bytes;
+    };
+
+    // Decode the next event read through reader, adding its delta-time to event.tick. False at
+    // the end of the data or a truncated event; throws at an event that cannot be decoded.
+    bool readStreamEvent(StreamReader& reader, uint8_t& runningStatus, StreamEvent& event);
+
+    // Split the single track of a Format 0 file into one output per MIDI channel, reading it once
+    // from the stream (positioned after MThd). Channel messages go to their channel's output; meta
+    // and SysEx events (tempo, time signature, names, ...) go to every output open when they
+    // arrive. An output opened at a channel's first event starts with the latest track name,
+    // instrument name, tempo, time signature and key signature, the only ones kept, so memory
+    // stays bounded however many lyrics, markers or SysEx dumps the file has. Output names are
+    // reserved in planned when given (other splits of a batch).
+    void splitFormat0(std::istream& in, const MIDIHeader& midiHeader, const std::string& baseName,
+                      const std::string& outputDir, const SplitOptions& options, PlannedOutputs* planned = nullptr);
+
+    // One input track of a merge: its own handle on the file, a small read buffer and the event
+    // due next, so memory per track stays constant however long the track is
+    struct MergeCursor {
+        std::ifstream file;
+        std::unique_ptr<StreamReader> reader;
+        std::string source; // "<file> track N", for messages
+        uint8_t runningStatus = 0;
+        StreamEvent event;
+    };
+
+    static constexpr size_t MERGE_READ_BUFFER_SIZE = 64 << 10;
+
+    // Step a merge cursor to its next event; false once its track has ended
+    bool advanceCursor(MergeCursor& cursor);
+
+    // Every merged track keeps its file open, so allow as many open files as the system permits
+    void raiseOpenFileLimit();
+
+    // Split in one forward pass: each output is opened as soon as its MTrk header is read and the
+    // track is streamed straight through, so total input I/O equals the file size and nothing is seeked
+    // inFd, when not -1, refers to the same input and is only used for page cache advice.
+    // A track whose MTrk length does not lead to the next track cannot be measured again in one
+    // pass; its output is removed and the split stops with an error. Output names are reserved in
+    // planned when given (other splits of a batch).
+    void splitMIDIStream(std::istream& in, int inFd, const std::string& baseName, const std::string& outputDir,
+                         const SplitOptions& options, PlannedOutputs* planned = nullptr);
+
+#ifdef MIDISPLITTER_HAVE_IO_URING
+    // Tracks above this size go through the regular copy engine, where syscall count no longer matters
+    static constexpr size_t IO_URING_MAX_TRACK_BYTES = 16 << 20;
+    static constexpr unsigned IO_URING_QUEUE_DEPTH = 1024;
+    static constexpr unsigned IO_URING_OPS_PER_TRACK = 5;
+
+    // Set up a ring with a direct descriptor slot per track of a batch, or nullptr if the kernel refuses
+    std::unique_ptr<IoUring> createIoUring();
+
+    // Write the tracks through io_uring. Every small track becomes one linked chain of
+    // openat -> fallocate -> write header -> write track -> close on a direct descriptor, and a
+    // whole batch of chains goes to the kernel in a single io_uring_enter. Track data is written
+    // straight from the input mapping, so no read or splice step is needed. A track whose chain
+    // fails is rewritten with the regular writer, which reports any real error.
+    int writeTracksIoUring(IoUring& ring, const MappedFile& input, const std::vector<TrackInfo>& tracks,
+                           const std::vector<fs::path>& outputPaths, const OutputHeaders& headers,
+                           const SplitOptions& options);
+#endif
+
+    // Whether an 8-byte chunk header starts a chunk other than MTrk. SMF chunk types are four
+    // ASCII characters, and readers skip the chunks they do not know by their length (--reflink
+    // writes one, XPAD, in front of the track)
+    bool isForeignChunk(std::span<const uint8_t> header);
+
+    // Offset of the first chunk at or after position that is not a foreign chunk lying wholly in data
+    uint64_t skipForeignChunks(std::span<const uint8_t> data, uint64_t position);
+
+    // Read the next MTrk header from a stream into header, skipping the foreign chunks in front
+    // of it; position is the stream offset on entry and is moved past what was skipped
+    void readChunkHeader(std::istream& in, std::vector<uint8_t>& header, uint16_t trackNumber, uint64_t& position);
+
+    // Whether a chunk ending at end is followed by the next MTrk header or a foreign chunk that
+    // fits the file or, for the last track, by the end of the file (a truncated last track also
+    // counts; it is copied as far as it goes)
+    bool chunkEndsCleanly(std::span<const uint8_t> data, uint64_t end, bool lastTrack);
+
+    // Offset of the next "MTrk" signature at or after from, or data.size(); memchr skips to each 'M'
+    size_t findTrackSignature(std::span<const uint8_t> data, size_t from);
+
+    // Find the real length of a track whose MTrk length does not lead to the next chunk: its End
+    // of Track event when the events parse and it is followed by the next chunk, otherwise the
+    // next MTrk signature (or the end of the file). A track whose End of Track is where its
+    // length says keeps that length; what follows is then the next chunk's problem.
+    uint64_t recoverTrackSize(std::span<const uint8_t> rest, uint16_t trackNumber, uint32_t declaredSize, bool lastTrack);
+
+    // Index the track i whose MTrk header is at trackStartPos: measure it again when its length
+    // does not lead to the next chunk, and name it from its lead-in
+    TrackInfo indexTrack(std::span<const uint8_t> data, uint64_t trackStartPos, uint16_t i, uint16_t totalTracks);
+
+    // Walk the MTrk chunk headers, skipping foreign chunks, and name every track
+    std::vector<TrackInfo> indexTracks(std::span<const uint8_t> data, uint16_t totalTracks);
+
+    // A forward-only reader cannot measure a track again, so a track whose MTrk length does not
+    // lead to the next MTrk header stops it with an error saying how to recover the file
+    void checkNextTrackHeader(std::span<const uint8_t> header, uint16_t previousTrack, const std::string& remedy);
+
+    // Sidecar index layout (all integers big-endian, like SMF itself):
+    //   0  "MIDX"  4  version  8  input size  16  input mtime  24  FNV-1a hash of the first 64 KiB
+    //   32 format, track count, division, reserved (u16 each)
+    //   40 one 44-byte record per track: position, size (u64), declared size, name offset, name length,
+    //      instrument offset, instrument length (u32), number, program (FFFF when none), channel mask, reserved (u16)
+    //   then the track and instrument names, back to back
+    static constexpr uint32_t INDEX_VERSION = 3;
+    static constexpr size_t INDEX_HEADER_SIZE = 40;
+    static constexpr size_t INDEX_RECORD_SIZE = 44;
+    static constexpr size_t INDEX_HASHED_BYTES = 64 << 10;
+
+    struct InputFingerprint {
+        uint64_t size;
+        uint64_t modified;
+        uint64_t headerHash;
+    };
+
+    InputFingerprint fingerprintInput(const std::string& inputFile, std::span<const uint8_t> data);
+
+    std::string indexPathFor(const std::string& inputFile);
+
+    // Whether a track table fits the input it is used on: the tracks follow each other from the
+    // end of MThd with nothing but foreign chunks between them, each starts with an MTrk header holding its declared
+    // size, and each ends inside the input. The fingerprint of an index only covers the size,
+    // mtime and first 64 KiB, so this keeps an index that is stale or forged from sending the
+    // writers outside the mapping. A truncated last track fails it, so such files are rescanned.
+    bool trackTableFits(std::span<const uint8_t> data, const std::vector<TrackInfo>& tracks);
+
+    // Load the track table from the sidecar; false when it is missing, stale, malformed or does
+    // not fit the input
+    bool loadTrackIndex(const std::string& inputFile, const InputFingerprint& fingerprint, const MIDIHeader& midiHeader,
+                        std::span<const uint8_t> data, std::vector<TrackInfo>& tracks);
+
+    // Write the sidecar next to the input; written to a temporary file and renamed into place
+    // so a crash never leaves a half-written index behind
+    void saveTrackIndex(const std::string& inputFile, const InputFingerprint& fingerprint, const MIDIHeader& midiHeader,
+                        const std::vector<TrackInfo>& tracks);
+
+public:
+    explicit MIDISplitter(std::ostream& log = std::cout) : log_(log) {}
+
+    // Print the header fields and track table as JSON without writing any outputs. Tracks are
+    // read one at a time (only their lead-in; the rest is seeked over or skipped) and written as
+    // they are found, so memory stays constant and output starts with the first track. A regular
+    // file is mapped, so tracks whose MTrk length is wrong are measured again as in a split; from
+    // stdin such a track ends the table with an error. On an error the JSON is closed with an
+    // "error" member, so what was printed can still be parsed.
+    void inspectMIDIFile(const std::string& inputFile, std::ostream& out);
+
+    // One entry of the --inspect track table; entries after the first are preceded by a comma
+    void printTrackJson(std::ostream& out, const TrackInfo& track, bool first);
+
+    // Print per-track event statistics (events, notes, length in ticks, polyphony, channels)
+    // without writing outputs; tracks are decoded in parallel on options.jobs threads
+    void statsMIDIFile(const std::string& inputFile, const SplitOptions& options = SplitOptions());
+
+    // Merge every track of the input files into one Format 0 file: the inverse of a split. Each
+    // track is read through its own cursor, and a min-heap keyed on (tick, track) picks the next
+    // event, so events at the same tick keep their input order and only one event per track is
+    // held in memory. Delta-times and running status are re-encoded for the merged track, End of
+    // Track events are replaced by one at the latest end, and tempo, time signature and key
+    // signature events repeated at the same tick (conductor tracks of --conductor outputs) are
+    // written once. Only the first track name is kept as one; the others become text events.
+    void mergeMIDIFiles(const std::vector<std::string>& inputFiles, const std::string& outputFile);
+
+    // Track table of a mapped input: scanned, or loaded from (and saved to) the sidecar index
+    std::vector<TrackInfo> loadTracks(const std::string& inputFile, std::span<const uint8_t> data,
+                                      const MIDIHeader& midiHeader, bool useIndex);
+
+    // Everything a split of a mapped input needs before its outputs are written
+    struct SplitPlan {
+        std::unique_ptr<MappedFile> input;
+        MIDIHeader header;
+        std::vector<TrackInfo> tracks;      // Selected tracks only
+        std::vector<fs::path> outputPaths;  // One per selected track
+        std::vector<fs::path> partPaths;    // Part files reserved for the tracks that will be cut
+        std::vector<unsigned> partCounts;   // Part files written per track, 0 for a whole output
+        OutputHeaders headers;
+    };
+
+    // Map the input, build its track table (from the index when enabled), select tracks and
+    // choose the output paths, checking that the outputs fit. A Format 0 input is returned with
+    // its header only. Paths in planned (outputs of other splits of a batch) are not reused.
+    SplitPlan planSplit(const std::string& inputFile, const std::string& outputDir, const SplitOptions& options,
+                        PlannedOutputs* planned = nullptr);
+
+    // planned: output paths of the other splits of a batch, which the one-pass splits (streams and
+    // Format 0 files) do not reuse; a pool plans the outputs of mapped inputs itself
+    void splitMIDIFile(const std::string& inputFile, const std::string& outputDir,
+                       const SplitOptions& options = SplitOptions(), PlannedOutputs* planned = nullptr);
+};
+
+} // namespace detail
+} // namespace midisplitter
+
+#endif
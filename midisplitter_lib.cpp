@@ -0,0 +1,307 @@
+// The library: midisplitter::MidiFile (midisplitter.h) and the C interface (msplit.h) on top of
+// the splitter in midisplitter_core.cpp. These are all it exports.
+#include "midisplitter_core.h"
+#include "msplit.h"
+
+using namespace midisplitter::detail;
+
+// Library interface, see midisplitter.h
+namespace midisplitter {
+
+struct MIDISPLITTER_INTERNAL MidiFile::Impl {
+    std::ostream quiet{nullptr}; // Indexing notes are dropped
+    MIDISplitter splitter{quiet};
+    std::unique_ptr<MappedFile> input;
+    FileHeader header{};
+    std::vector<TrackEntry> tracks;
+    std::vector<uint8_t> outputHeader;
+
+    // Output header with the conductor track, built by the first extract that needs it
+    std::once_flag conductorBuilt;
+    std::vector<uint8_t> conductorHeader;
+};
+
+MidiFile::MidiFile(const std::string& path, bool useIndex) : impl_(std::make_unique<Impl>()) {
+    Impl& file = *impl_;
+    file.input = std::make_unique<MappedFile>(path);
+    std::span<const uint8_t> data = file.input->bytes();
+    if (data.size() < 14) {
+        throw std::runtime_error("Error reading MIDI header.");
+    }
+
+    MIDISplitter::MIDIHeader midiHeader = file.splitter.parseHeader(data.first(14));
+    file.header = {midiHeader.format, midiHeader.trackCount, midiHeader.division};
+    for (const auto& track : file.splitter.loadTracks(path, data, midiHeader, useIndex)) {
+        file.tracks.push_back({track.number, track.name, track.instrument, track.program, track.channels,
+                               track.position, track.size, track.recovered()});
+    }
+    file.outputHeader = file.splitter.buildOutputHeader(midiHeader.division);
+}
+
+MidiFile::~MidiFile() = default;
+MidiFile::MidiFile(MidiFile&&) noexcept = default;
+MidiFile& MidiFile::operator=(MidiFile&&) noexcept = default;
+
+const FileHeader& MidiFile::header() const {
+    return impl_->header;
+}
+
+std::span<const TrackEntry> MidiFile::tracks() const {
+    return impl_->tracks;
+}
+
+std::span<const uint8_t> MidiFile::trackBytes(size_t index) const {
+    const TrackEntry& track = impl_->tracks.at(index);
+    std::span<const uint8_t> data = impl_->input->bytes();
+
+    // The last track of a truncated file only has what is left of the input
+    uint64_t available = data.size() - std::min<uint64_t>(track.offset, data.size());
+    return data.subspan(static_cast<size_t>(std::min<uint64_t>(track.offset, data.size())),
+                        static_cast<size_t>(std::min<uint64_t>(8 + track.size, available)));
+}
+
+void MidiFile::extract(size_t index, TrackSink& sink, const ExtractOptions& options) const {
+    Impl& file = *impl_;
+    const TrackEntry& track = file.tracks.at(index);
+    if (track.size > MIDISplitter::MAX_MTRK_SIZE) {
+        throw std::runtime_error("Track " + std::to_string(track.number) + " is over 4 GB and does not fit in one output");
+    }
+
+    const std::vector<uint8_t>* outputHeader = &file.outputHeader;
+    if (options.embedConductor && track.number != 1 && !file.tracks.empty()) {
+        std::call_once(file.conductorBuilt, [&] {
+            std::vector<uint8_t> conductor = file.splitter.extractConductor(trackBytes(0).subspan(8));
+            if (!conductor.empty()) {
+                file.conductorHeader = file.splitter.buildOutputHeader(file.header.division, conductor);
+            }
+        });
+        if (!file.conductorHeader.empty()) {
+            outputHeader = &file.conductorHeader;
+        }
+    }
+
+    // A corrected MTrk header replaces the one in the input; the event data is passed as it is
+    std::span<const uint8_t> chunk = trackBytes(index);
+    std::array<uint8_t, 8> chunkHeader = {'M', 'T', 'r', 'k'};
+    if (track.recovered) {
+        auto size = file.splitter.uint32ToBytes(static_cast<uint32_t>(track.size));
+        std::copy(size.begin(), size.end(), chunkHeader.begin() + 4);
+    }
+
+    sink.begin(track, outputHeader->size() + chunk.size());
+    sink.write(*outputHeader);
+    if (track.recovered) {
+        sink.write(chunkHeader);
+        sink.write(chunk.subspan(8));
+    } else {
+        sink.write(chunk);
+    }
+    sink.end(track);
+}
+
+void MidiFile::split(TrackSink& sink, const ExtractOptions& options) const {
+    for (size_t index = 0; index < impl_->tracks.size(); index++) {
+        extract(index, sink, options);
+    }
+}
+
+} // namespace midisplitter
+
+// C interface, see msplit.h. Every exception is caught here and turned into an error code.
+struct msplit_file {
+    midisplitter::MidiFile file;
+};
+
+namespace {
+
+thread_local std::string msplitLastError;
+
+// Writing to the caller's descriptor failed; error is the errno value
+struct FdWriteError : std::runtime_error {
+    explicit FdWriteError(int error) : std::runtime_error(std::string("Error writing to output file: ") + std::strerror(error)), error(error) {}
+    int error;
+};
+
+// Record the message of the exception being handled and return its error code
+int msplitFailure() {
+    try {
+        throw;
+    } catch (const std::bad_alloc&) {
+        msplitLastError = "Out of memory";
+        return MSPLIT_ERR_MEMORY;
+    } catch (const FdWriteError& e) {
+        msplitLastError = e.what();
+        errno = e.error;
+        return MSPLIT_ERR_IO;
+    } catch (const std::exception& e) {
+        msplitLastError = e.what();
+    } catch (...) {
+        msplitLastError = "Unknown error";
+    }
+    return MSPLIT_ERR_FAILED;
+}
+
+int msplitArgumentError(const char* message) {
+    msplitLastError = message;
+    return MSPLIT_ERR_ARGUMENT;
+}
+
+// Copy a string into a caller's buffer, NUL-terminated and cut to fit
+void copyToBuffer(const std::string& text, char* buffer, size_t size) {
+    if (buffer == nullptr || size == 0) return;
+    size_t length = std::min(text.size(), size - 1);
+    std::memcpy(buffer, text.data(), length);
+    buffer[length] = '\0';
+}
+
+// Writes outputs to a descriptor owned by the caller. A reader that has gone away must not kill
+// the host with SIGPIPE: sockets are written with MSG_NOSIGNAL where the system has it, anything
+// else with SIGPIPE blocked on the calling thread, and a SIGPIPE raised by the write is taken
+// back before it is unblocked. Either way the write fails with EPIPE.
+class FdSink : public midisplitter::TrackSink {
+public:
+    explicit FdSink(int fd) : fd_(fd) {
+#if !defined(_WIN32) && defined(MSG_NOSIGNAL)
+        struct stat info;
+        socket_ = ::fstat(fd, &info) == 0 && S_ISSOCK(info.st_mode);
+#endif
+    }
+
+    void begin(const midisplitter::TrackEntry&, uint64_t) override {}
+
+    void write(std::span<const uint8_t> data) override {
+#ifdef _WIN32
+        const uint8_t* next = data.data();
+        size_t size = data.size();
+        while (size > 0) {
+            int written = ::_write(fd_, next, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+            if (written < 0) {
+                throw FdWriteError(errno);
+            }
+            next += written;
+            size -= static_cast<size_t>(written);
+        }
+#else
+#ifdef MSG_NOSIGNAL
+        if (socket_) {
+            writeLoop(data, [this](const uint8_t* next, size_t size) { return ::send(fd_, next, size, MSG_NOSIGNAL); });
+            return;
+        }
+#endif
+
+        sigset_t pipeSignal, previousMask, pending;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        // A SIGPIPE that was already pending is not ours to take
+        bool alreadyPending = ::sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE);
+        ::pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+        int error = 0;
+        try {
+            writeLoop(data, [this](const uint8_t* next, size_t size) { return ::write(fd_, next, size); });
+        } catch (const FdWriteError& e) {
+            error = e.error;
+        }
+        // Only waited for when pending, so sigwait returns at once (Darwin has no sigtimedwait)
+        if (error == EPIPE && !alreadyPending && ::sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+            int signal = 0;
+            ::sigwait(&pipeSignal, &signal);
+        }
+        ::pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        if (error != 0) {
+            throw FdWriteError(error);
+        }
+#endif
+    }
+
+    void end(const midisplitter::TrackEntry&) override {}
+
+private:
+#ifndef _WIN32
+    // Write all of data through writeSome, retrying short writes and EINTR
+    template <typename WriteSome>
+    static void writeLoop(std::span<const uint8_t> data, WriteSome writeSome) {
+        const uint8_t* next = data.data();
+        size_t size = data.size();
+        while (size > 0) {
+            ssize_t written = writeSome(next, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw FdWriteError(errno);
+            }
+            next += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+#endif
+
+    int fd_;
+#if !defined(_WIN32) && defined(MSG_NOSIGNAL)
+    bool socket_ = false;
+#endif
+};
+
+} // namespace
+
+extern "C" {
+
+int msplit_abi_version(void) {
+    return MSPLIT_ABI_VERSION;
+}
+
+int msplit_open(const char* path, int use_index, msplit_file** file) {
+    if (path == nullptr || file == nullptr) return msplitArgumentError("Null argument");
+    *file = nullptr;
+    try {
+        *file = new msplit_file{midisplitter::MidiFile(path, use_index != 0)};
+        return MSPLIT_OK;
+    } catch (...) {
+        return msplitFailure();
+    }
+}
+
+size_t msplit_track_count(const msplit_file* file) {
+    return file != nullptr ? file->file.tracks().size() : 0;
+}
+
+int msplit_track_info(const msplit_file* file, size_t index, msplit_track* info,
+                      char* name, size_t name_size, char* instrument, size_t instrument_size) {
+    if (file == nullptr || info == nullptr) return msplitArgumentError("Null argument");
+    std::span<const midisplitter::TrackEntry> tracks = file->file.tracks();
+    if (index >= tracks.size()) return msplitArgumentError("Track index out of range");
+
+    const midisplitter::TrackEntry& track = tracks[index];
+    info->number = track.number;
+    info->program = track.program;
+    info->channels = track.channels;
+    info->recovered = track.recovered ? 1 : 0;
+    info->offset = track.offset;
+    info->size = track.size;
+    info->name_length = track.name.size();
+    info->instrument_length = track.instrument.size();
+    copyToBuffer(track.name, name, name_size);
+    copyToBuffer(track.instrument, instrument, instrument_size);
+    return MSPLIT_OK;
+}
+
+int msplit_extract_to_fd(const msplit_file* file, size_t index, int fd, unsigned flags) {
+    if (file == nullptr) return msplitArgumentError("Null argument");
+    if (index >= file->file.tracks().size()) return msplitArgumentError("Track index out of range");
+    try {
+        FdSink sink(fd);
+        file->file.extract(index, sink, {.embedConductor = (flags & MSPLIT_CONDUCTOR) != 0});
+        return MSPLIT_OK;
+    } catch (...) {
+        return msplitFailure();
+    }
+}
+
+void msplit_close(msplit_file* file) {
+    delete file;
+}
+
+size_t msplit_last_error(char* buffer, size_t size) {
+    copyToBuffer(msplitLastError, buffer, size);
+    return msplitLastError.size();
+}
+
+} // extern "C"
@@ -0,0 +1,74 @@
+/* C interface of the MIDI splitter, for bindings (Python ctypes/cffi, Go cgo, ...).
+ *
+ * Built from midisplitter_lib.cpp, like midisplitter.h, which it wraps. No C++ exception crosses
+ * these functions: failures return a negative MSPLIT_ERR_* code and the message can be read
+ * with msplit_last_error on the same thread. Strings are copied into buffers owned by the
+ * caller.
+ */
+#ifndef MSPLIT_H
+#define MSPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a declaration below changes incompatibly */
+#define MSPLIT_ABI_VERSION 1
+
+#define MSPLIT_OK 0
+#define MSPLIT_ERR_ARGUMENT -1 /* Null pointer or track index out of range */
+#define MSPLIT_ERR_FAILED -2   /* Unreadable or malformed input, track over 4 GB */
+#define MSPLIT_ERR_MEMORY -3
+#define MSPLIT_ERR_IO -4       /* Writing to the descriptor failed; errno holds the cause */
+
+/* msplit_extract_to_fd flags */
+#define MSPLIT_CONDUCTOR 1 /* Precede the track with track 1's tempo map, as with --conductor */
+
+typedef struct msplit_file msplit_file;
+
+typedef struct msplit_track {
+    uint16_t number;     /* From 1, in file order */
+    int16_t program;     /* First program change, -1 when there is none */
+    uint16_t channels;   /* Bit n set when channel n + 1 is used before the first non-zero delta-time */
+    uint8_t recovered;   /* 1 when the MTrk length was wrong and outputs get a corrected one */
+    uint64_t offset;     /* Offset of the MTrk chunk in the input */
+    uint64_t size;       /* Length of the event data */
+    /* Full lengths of the names without the terminator, even when they were cut to fit */
+    size_t name_length;
+    size_t instrument_length;
+} msplit_track;
+
+int msplit_abi_version(void);
+
+/* Map and index a MIDI file. use_index: load and keep a "<path>.midx" track index, as with
+ * --index. On success *file must be released with msplit_close. */
+int msplit_open(const char* path, int use_index, msplit_file** file);
+
+/* Number of tracks of an open file, 0 for NULL */
+size_t msplit_track_count(const msplit_file* file);
+
+/* Fill *info for track index (from 0). name and instrument, when not NULL, receive the track
+ * and instrument names NUL-terminated and cut to their buffer size. */
+int msplit_track_info(const msplit_file* file, size_t index, msplit_track* info,
+                      char* name, size_t name_size, char* instrument, size_t instrument_size);
+
+/* Write the output of track index (a complete MIDI file) to fd, which may be a file, pipe or
+ * socket; short writes are retried. Different tracks may be extracted from several threads.
+ * A pipe or socket whose reader has closed it does not raise SIGPIPE: MSPLIT_ERR_IO is
+ * returned with errno set to EPIPE. */
+int msplit_extract_to_fd(const msplit_file* file, size_t index, int fd, unsigned flags);
+
+void msplit_close(msplit_file* file);
+
+/* Copy the message of the last failure on this thread into buffer (NUL-terminated, cut to
+ * size) and return its full length; 0 when nothing failed yet */
+size_t msplit_last_error(char* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1358 @@
+// Tests of the splitter on synthetic MIDI files, built in memory and written to a scratch folder.
+// There is no build system; from the repository root:
+//
+//     g++ -std=c++20 -O2 -pthread tests/midisplitter_test.cpp midisplitter_core.cpp midisplitter_lib.cpp -o midisplitter_test && ./midisplitter_test
+//
+// Every output is parsed again with the splitter's own event decoder. Given the path of a built
+// midisplitter2 (./midisplitter_test ./midisplitter2), the command line tool is run as well.
+// Exits with 1 when a check fails.
+#include "../midisplitter.h"
+#include "../midisplitter_core.h"
+#include "../msplit.h"
+
+#include <future>
+#include <random>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace midisplitter::detail;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(...) check((__VA_ARGS__), #__VA_ARGS__, __LINE__)
+
+void check(bool ok, const char* condition, int line) {
+    if (!ok) {
+        std::cerr << "  FAILED line " << line << ": " << condition << std::endl;
+        failures++;
+    }
+}
+
+// The midisplitter2 given on the command line; the checks that run it are skipped without one
+std::string toolPath;
+
+std::string shellQuote(const std::string& text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// Run the tool, returning its exit status and everything it printed
+std::pair<int, std::string> runTool(const std::vector<std::string>& arguments) {
+    std::string command = shellQuote(toolPath);
+    for (const auto& argument : arguments) {
+        command += " " + shellQuote(argument);
+    }
+    FILE* pipe = ::popen((command + " </dev/null 2>&1").c_str(), "r");
+    if (!pipe) throw std::runtime_error("Cannot run " + toolPath);
+    std::string output;
+    char buffer[4096];
+    while (size_t length = std::fread(buffer, 1, sizeof(buffer), pipe)) {
+        output.append(buffer, length);
+    }
+    int status = ::pclose(pipe);
+    return {WIFEXITED(status) ? WEXITSTATUS(status) : -1, output};
+}
+
+void appendVarLen(std::vector<uint8_t>& out, uint64_t value) {
+    uint8_t bytes[10];
+    size_t count = 0;
+    do {
+        bytes[count++] = static_cast<uint8_t>(value & 0x7F);
+        value >>= 7;
+    } while (value > 0);
+    while (count > 0) {
+        count--;
+        out.push_back(static_cast<uint8_t>(bytes[count] | (count > 0 ? 0x80 : 0)));
+    }
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+uint64_t readBigEndian(std::span<const uint8_t> data, size_t offset, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | data[offset + i];
+    }
+    return value;
+}
+
+// Event data of one track, written as given: leaving out a status byte makes running status
+class TrackBuilder {
+public:
+    TrackBuilder& event(uint32_t delta, std::initializer_list<uint8_t> bytes) {
+        appendVarLen(data, delta);
+        data.insert(data.end(), bytes);
+        return *this;
+    }
+
+    TrackBuilder& meta(uint32_t delta, uint8_t type, const std::string& text) {
+        appendVarLen(data, delta);
+        data.push_back(0xFF);
+        data.push_back(type);
+        appendVarLen(data, text.size());
+        data.insert(data.end(), text.begin(), text.end());
+        return *this;
+    }
+
+    TrackBuilder& end(uint32_t delta = 0) {
+        return event(delta, {0xFF, 0x2F, 0x00});
+    }
+
+    std::vector<uint8_t> data;
+};
+
+// A whole file; declaredSizes overrides the MTrk length of the tracks it has an entry for
+std::vector<uint8_t> buildFile(uint16_t format, uint16_t division, const std::vector<std::vector<uint8_t>>& tracks,
+                               const std::map<size_t, uint32_t>& declaredSizes = {}) {
+    std::vector<uint8_t> file = {'M', 'T', 'h', 'd', 0, 0, 0, 6};
+    appendBigEndian(file, format, 2);
+    appendBigEndian(file, tracks.size(), 2);
+    appendBigEndian(file, division, 2);
+    for (size_t index = 0; index < tracks.size(); index++) {
+        file.insert(file.end(), {'M', 'T', 'r', 'k'});
+        auto declared = declaredSizes.find(index);
+        appendBigEndian(file, declared != declaredSizes.end() ? declared->second : tracks[index].size(), 4);
+        file.insert(file.end(), tracks[index].begin(), tracks[index].end());
+    }
+    return file;
+}
+
+// A chunk of a type readers do not know, which they skip by its length
+std::vector<uint8_t> foreignChunk(const std::string& type, const std::string& payload) {
+    std::vector<uint8_t> chunk(type.begin(), type.end());
+    appendBigEndian(chunk, payload.size(), 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    return chunk;
+}
+
+void writeFile(const fs::path& path, const std::vector<uint8_t>& bytes) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!out) throw std::runtime_error("Cannot write " + path.string());
+}
+
+std::vector<uint8_t> readFile(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot read " + path.string());
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// An event at its absolute tick, status first with running status resolved
+struct Event {
+    uint64_t tick;
+    std::vector<uint8_t> bytes;
+
+    bool operator==(const Event&) const = default;
+    bool isChannel() const { return bytes[0] < 0xF0; }
+    bool isNoteOn() const { return (bytes[0] & 0xF0) == 0x90 && bytes[2] != 0; }
+    bool isNoteOff() const { return (bytes[0] & 0xF0) == 0x80 || ((bytes[0] & 0xF0) == 0x90 && bytes[2] == 0); }
+};
+
+struct ParsedFile {
+    uint16_t format;
+    uint16_t division;
+    std::vector<std::vector<Event>> tracks;
+};
+
+// Parse a file strictly: the MTrk lengths must be exact, every event must decode and every track
+// must end with End of Track as its last event
+ParsedFile parseFile(const std::vector<uint8_t>& file) {
+    std::span<const uint8_t> data(file);
+    if (data.size() < 14 || std::memcmp(data.data(), "MThd", 4) != 0 || readBigEndian(data, 4, 4) != 6) {
+        throw std::runtime_error("bad MThd");
+    }
+    ParsedFile parsed{static_cast<uint16_t>(readBigEndian(data, 8, 2)), static_cast<uint16_t>(readBigEndian(data, 12, 2)), {}};
+    uint64_t trackCount = readBigEndian(data, 10, 2);
+
+    size_t pos = 14;
+    for (uint64_t number = 1; number <= trackCount; number++) {
+        if (data.size() - pos < 8 || std::memcmp(data.data() + pos, "MTrk", 4) != 0) {
+            throw std::runtime_error("missing MTrk " + std::to_string(number));
+        }
+        uint64_t length = readBigEndian(data, pos + 4, 4);
+        if (data.size() - pos - 8 < length) throw std::runtime_error("MTrk " + std::to_string(number) + " runs past the file");
+        std::span<const uint8_t> events = data.subspan(pos + 8, length);
+
+        std::vector<Event>& track = parsed.tracks.emplace_back();
+        TrackEvent event;
+        uint8_t runningStatus = 0;
+        uint64_t tick = 0;
+        bool ended = false;
+        for (size_t offset = 0; offset < events.size(); offset = event.end) {
+            if (ended || nextEvent(events, offset, runningStatus, event) != EventParse::Ok) {
+                throw std::runtime_error("bad event in track " + std::to_string(number) + " at " + std::to_string(offset));
+            }
+            tick += event.delta;
+            Event& decoded = track.emplace_back(Event{tick, {}});
+            if (event.runningStatus) decoded.bytes.push_back(event.status);
+            decoded.bytes.insert(decoded.bytes.end(), events.begin() + event.body, events.begin() + event.end);
+            runningStatus = runningStatusAfter(event);
+            ended = isEndOfTrack(event);
+        }
+        if (!ended) throw std::runtime_error("track " + std::to_string(number) + " has no End of Track");
+        pos += 8 + length;
+    }
+    if (pos != data.size()) throw std::runtime_error("bytes after the last track");
+    return parsed;
+}
+
+std::vector<Event> channelEvents(const std::vector<Event>& events, int channel = -1) {
+    std::vector<Event> result;
+    for (const Event& event : events) {
+        if (event.isChannel() && (channel < 0 || (event.bytes[0] & 0x0F) == channel)) result.push_back(event);
+    }
+    return result;
+}
+
+// Controllers, programs and pitch bends in effect, and the notes sounding, as an event stream
+// leaves them
+struct ChannelState {
+    std::map<std::pair<uint8_t, uint8_t>, uint8_t> controllers;  // (channel, controller) -> value
+    std::map<uint8_t, uint8_t> programs;
+    std::map<uint8_t, std::pair<uint8_t, uint8_t>> pitchBends;
+    std::map<std::pair<uint8_t, uint8_t>, int> sounding;         // (channel, key) -> notes on it
+
+    void apply(const Event& event) {
+        uint8_t channel = event.bytes[0] & 0x0F;
+        switch (event.bytes[0] & 0xF0) {
+            case 0xB0: controllers[{channel, event.bytes[1]}] = event.bytes[2]; break;
+            case 0xC0: programs[channel] = event.bytes[1]; break;
+            case 0xE0: pitchBends[channel] = {event.bytes[1], event.bytes[2]}; break;
+        }
+        if (event.isNoteOn()) {
+            sounding[{channel, event.bytes[1]}]++;
+        } else if (event.isNoteOff() && sounding[{channel, event.bytes[1]}] > 0) {
+            sounding[{channel, event.bytes[1]}]--;
+        }
+    }
+
+    bool sameControls(const ChannelState& other) const {
+        return controllers == other.controllers && programs == other.programs && pitchBends == other.pitchBends;
+    }
+
+    int notesSounding() const {
+        int total = 0;
+        for (const auto& [key, count] : sounding) total += count;
+        return total;
+    }
+};
+
+// A track of running-status notes on channel 1 under a note held from start to end, with a
+// controller, program and pitch bend set at the start and changed halfway
+std::vector<uint8_t> buildLongTrack(int notes) {
+    TrackBuilder track;
+    track.meta(0, 0x03, "Piano").meta(0, 0x04, "Grand");
+    track.event(0, {0xB0, 7, 100}).event(0, {0xC0, 5}).event(0, {0xE0, 0x00, 0x50});
+    track.event(0, {0x90, 40, 90});
+    for (int i = 0; i < notes; i++) {
+        uint8_t key = static_cast<uint8_t>(50 + i % 24);
+        if (i == notes / 2) {
+            track.event(1, {0xB0, 7, 80}).event(0, {0xC0, 12}).event(0, {0xE0, 0x00, 0x30});
+            track.event(0, {0x90, key, 64});
+        } else {
+            track.event(2, {key, 64}); // Running status
+        }
+        track.event(1, {key, 0});
+    }
+    track.event(4, {40, 0}).end();
+    return track.data;
+}
+
+std::vector<fs::path> filesMatching(const fs::path& dir, const std::string& part) {
+    std::vector<fs::path> found;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.path().filename().string().find(part) != std::string::npos) found.push_back(entry.path());
+    }
+    std::sort(found.begin(), found.end(), [](const fs::path& a, const fs::path& b) {
+        return a.string().size() != b.string().size() ? a.string().size() < b.string().size() : a < b;
+    });
+    return found;
+}
+
+// Each output of a plain split is the MThd header of a one-track Format 1 file followed by the
+// track's MTrk chunk exactly as in the input, however large the chunk; existing outputs are kept
+void testPlainSplit(const fs::path& dir) {
+    std::vector<std::vector<uint8_t>> tracks = {
+        TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data,
+        TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data,
+        buildLongTrack(400000), // About 3 MB, copied in several pieces
+    };
+    writeFile(dir / "plain.mid", buildFile(1, 96, tracks));
+
+    std::ostringstream log;
+    MIDISplitter(log).splitMIDIFile((dir / "plain.mid").string(), (dir / "out").string());
+    CHECK(readFile(dir / "out" / "plain - Tempo.mid") == buildFile(1, 96, {tracks[0]}));
+    CHECK(readFile(dir / "out" / "plain - Lead.mid") == buildFile(1, 96, {tracks[1]}));
+    CHECK(readFile(dir / "out" / "plain - Piano.mid") == buildFile(1, 96, {tracks[2]}));
+
+    MIDISplitter(log).splitMIDIFile((dir / "plain.mid").string(), (dir / "out").string());
+    CHECK(readFile(dir / "out" / "plain - Piano (Copy 1).mid") == buildFile(1, 96, {tracks[2]}));
+    CHECK(std::distance(fs::directory_iterator(dir / "out"), fs::directory_iterator()) == 6);
+}
+
+// Contents of every file in dir, by file name
+std::map<std::string, std::vector<uint8_t>> readOutputs(const fs::path& dir) {
+    std::map<std::string, std::vector<uint8_t>> outputs;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        outputs[entry.path().filename().string()] = readFile(entry.path());
+    }
+    return outputs;
+}
+
+// A file of many tracks of mixed sizes, one of them large, split by each writer in turn: they
+// all produce the same files as the sequential writer
+void testWriterModesMatch(const fs::path& dir) {
+    std::vector<std::vector<uint8_t>> tracks = {TrackBuilder().meta(0, 0x03, "Tempo").end().data};
+    for (int i = 1; i < 150; i++) {
+        TrackBuilder track;
+        track.meta(0, 0x03, "Voice " + std::to_string(i)).event(0, {0xC0, static_cast<uint8_t>(i % 128)});
+        for (int note = 0; note < i * 20; note++) {
+            track.event(1, {0x90, static_cast<uint8_t>(40 + note % 40), 80}).event(1, {0x80, static_cast<uint8_t>(40 + note % 40), 0});
+        }
+        tracks.push_back(track.end().data);
+    }
+    tracks.push_back(buildLongTrack(300000));
+    fs::path input = dir / "voices.mid";
+    writeFile(input, buildFile(1, 480, tracks));
+
+    auto splitWith = [&](const std::string& name, const SplitOptions& options) {
+        fs::path out = dir / name;
+        fs::create_directories(out);
+        std::ostringstream log;
+        MIDISplitter(log).splitMIDIFile(input.string(), out.string(), options);
+        return readOutputs(out);
+    };
+    auto expected = splitWith("sequential", SplitOptions());
+    CHECK(expected.size() == tracks.size());
+    CHECK(expected["voices - Voice 7.mid"] == buildFile(1, 480, {tracks[7]}));
+
+    SplitOptions options;
+    options.jobs = 4;
+    CHECK(splitWith("jobs", options) == expected);
+
+    // Falls back to the regular writer where io_uring is unavailable
+    options = SplitOptions();
+    options.ioUring = true;
+    CHECK(splitWith("io_uring", options) == expected);
+
+    // Windows much smaller than the large track, so it is copied over several of them
+    options = SplitOptions();
+    options.cacheWindow = 256 << 10;
+    CHECK(splitWith("cache_window", options) == expected);
+    options.singlePass = true;
+    CHECK(splitWith("cache_window_stream", options) == expected);
+
+    // Falls back to buffered writes where the filesystem refuses O_DIRECT; with several writers
+    // the aligned buffers are shared between them
+    options = SplitOptions();
+    options.directIO = true;
+    CHECK(splitWith("direct", options) == expected);
+    options.jobs = 4;
+    CHECK(splitWith("direct_jobs", options) == expected);
+}
+
+// A split needing more than the free space of the output folder is refused while it is planned,
+// with --reflink as well, as any clone may end up a copy. The tracks are holes in a sparse
+// input, which takes no space itself; only the plan is made, so nothing is written should the
+// check let it through.
+void testFreeSpaceCheck(const fs::path& dir) {
+    const uint64_t trackSize = 0xFFFF0000;
+    uint64_t trackCount = fs::space(dir).available / trackSize + 2;
+    if (trackCount > 4096) return; // Too much space to outgrow with a sparse file
+
+    fs::path input = dir / "huge.mid";
+    {
+        std::vector<uint8_t> header = buildFile(1, 96, {});
+        header[10] = static_cast<uint8_t>(trackCount >> 8);
+        header[11] = static_cast<uint8_t>(trackCount);
+        std::ofstream out(input, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+        for (uint64_t track = 0; track < trackCount; track++) {
+            std::vector<uint8_t> chunk = {'M', 'T', 'r', 'k'};
+            appendBigEndian(chunk, trackSize, 4);
+            out.seekp(static_cast<std::streamoff>(14 + track * (8 + trackSize)));
+            out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+        }
+    }
+    fs::resize_file(input, 14 + trackCount * (8 + trackSize));
+
+    for (bool reflink : {false, true}) {
+        std::ostringstream log;
+        SplitOptions options;
+        options.reflinkAligned = reflink;
+        std::string error;
+        try {
+            MIDISplitter(log).planSplit(input.string(), (dir / "out").string(), options);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        CHECK(error.find("Not enough free space") != std::string::npos);
+    }
+}
+
+// The SSE2 and AVX2 name meta finders agree with a byte-by-byte search for every start offset
+// of buffers of every length up to a few vector widths, with FF bytes at block edges and last
+void testNameMetaFinders(const fs::path&) {
+    std::vector<std::pair<const char*, size_t (*)(const uint8_t*, size_t, size_t)>> finders = {
+        {"scalar", findNameMetaScalar}};
+#ifdef MIDISPLITTER_HAVE_SSE2
+    finders.emplace_back("SSE2", findNameMetaSSE2);
+#endif
+#ifdef MIDISPLITTER_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) finders.emplace_back("AVX2", findNameMetaAVX2);
+#endif
+    auto reference = [](const std::vector<uint8_t>& data, size_t from) {
+        for (size_t pos = from; pos + 1 < data.size(); pos++) {
+            if (data[pos] == 0xFF && (data[pos + 1] == 0x03 || data[pos + 1] == 0x04)) return pos;
+        }
+        return data.size();
+    };
+
+    std::mt19937 random(7);
+    const uint8_t afterStatus[] = {0x00, 0x03, 0x04, 0x05, 0x2F, 0xFF};
+    for (size_t size = 0; size <= 200; size++) {
+        for (int round = 0; round < 20; round++) {
+            std::vector<uint8_t> data(size);
+            for (auto& byte : data) byte = static_cast<uint8_t>(random() % 0x80);
+            for (size_t hits = random() % 6; hits > 0 && size >= 2; hits--) {
+                size_t pos = random() % 3 == 0 ? (random() % (size / 16 + 1)) * 16 + 15 : random() % size;
+                pos = std::min(pos, size - 1);
+                data[pos] = 0xFF;
+                if (pos + 1 < size) data[pos + 1] = afterStatus[random() % std::size(afterStatus)];
+            }
+            for (size_t from = 0; from <= size; from++) {
+                for (const auto& [name, finder] : finders) {
+                    if (finder(data.data(), data.size(), from) != reference(data, from)) {
+                        std::cerr << "  " << name << " finder, size " << size << ", from " << from << std::endl;
+                        CHECK(false);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// --inspect prints the header and one line per track, with names escaped for JSON, the first
+// program change and the channels used before the first non-zero delta-time
+void testInspectJson(const fs::path& dir) {
+    std::vector<std::vector<uint8_t>> tracks = {
+        TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data,
+        TrackBuilder().meta(0, 0x03, "Str\"ngs\\1").meta(0, 0x04, "Violins").event(0, {0xC0, 48})
+            .event(0, {0x91, 60, 1}).event(0, {0x9A, 36, 1}).event(10, {0x80, 60, 0}).end().data,
+        TrackBuilder().event(5, {0x92, 60, 1}).event(10, {60, 0}).end().data,
+    };
+    fs::path input = dir / "table.mid";
+    writeFile(input, buildFile(1, 480, tracks));
+
+    std::ostringstream log;
+    std::ostringstream json;
+    MIDISplitter(log).inspectMIDIFile(input.string(), json);
+    std::string expected =
+        "{\"file\": \"" + input.string() + "\", \"format\": 1, \"division\": 480, \"trackCount\": 3, \"tracks\": [\n"
+        "  {\"number\": 1, \"offset\": 14, \"size\": " + std::to_string(tracks[0].size()) +
+        ", \"name\": \"Tempo\", \"instrument\": \"\", \"program\": null, \"channels\": []},\n"
+        "  {\"number\": 2, \"offset\": " + std::to_string(14 + 8 + tracks[0].size()) + ", \"size\": " + std::to_string(tracks[1].size()) +
+        ", \"name\": \"Str\\\"ngs\\\\1\", \"instrument\": \"Violins\", \"program\": 48, \"channels\": [1, 2, 11]},\n"
+        "  {\"number\": 3, \"offset\": " + std::to_string(14 + 16 + tracks[0].size() + tracks[1].size()) + ", \"size\": " +
+        std::to_string(tracks[2].size()) + ", \"name\": \"Track 3\", \"instrument\": \"\", \"program\": null, \"channels\": []}\n"
+        "]}\n";
+    CHECK(json.str() == expected);
+    if (json.str() != expected) std::cerr << json.str();
+    CHECK(fs::is_empty(dir / "out"));
+}
+
+// Track selectors pick the same tracks whether the input is mapped or read in one pass, and
+// combine; byte sizes with a sign or leading spaces are refused by the tool
+void testSelectors(const fs::path& dir) {
+    auto notes = [](const std::string& name, int count) {
+        TrackBuilder track;
+        track.meta(0, 0x03, name);
+        for (int i = 0; i < count; i++) track.event(1, {0x90, 60, 90}).event(1, {0x80, 60, 0});
+        return track.end().data;
+    };
+    std::vector<std::vector<uint8_t>> tracks = {
+        TrackBuilder().meta(0, 0x03, "Tempo").end().data, notes("Lead Guitar", 10), notes("Bass", 100),
+        notes("Rhythm Guitar", 1000), notes("Drums", 10)};
+    fs::path input = dir / "band.mid";
+    writeFile(input, buildFile(1, 96, tracks));
+
+    auto selected = [&](const SplitOptions& options) {
+        std::set<std::string> names;
+        for (bool singlePass : {false, true}) {
+            fs::path out = dir / "selected";
+            fs::remove_all(out);
+            fs::create_directories(out);
+            std::ostringstream log;
+            SplitOptions selecting = options;
+            selecting.singlePass = singlePass;
+            MIDISplitter(log).splitMIDIFile(input.string(), out.string(), selecting);
+            std::set<std::string> found;
+            for (const auto& [name, bytes] : readOutputs(out)) {
+                found.insert(name.substr(std::string("band - ").size(), name.size() - std::string("band - .mid").size()));
+                auto track = std::find_if(tracks.begin(), tracks.end(), [&](const auto& data) {
+                    return bytes == buildFile(1, 96, {data});
+                });
+                CHECK(track != tracks.end());
+            }
+            CHECK(!singlePass || found == names);
+            names = found;
+        }
+        return names;
+    };
+
+    SplitOptions options;
+    options.trackRanges = {{2, 3}, {5, 5}};
+    CHECK(selected(options) == std::set<std::string>{"Lead Guitar", "Bass", "Drums"});
+
+    options = SplitOptions();
+    options.nameRegex = "Guitar$";
+    CHECK(selected(options) == std::set<std::string>{"Lead Guitar", "Rhythm Guitar"});
+
+    options = SplitOptions();
+    options.minSize = tracks[2].size();
+    options.maxSize = tracks[2].size();
+    CHECK(selected(options) == std::set<std::string>{"Bass"});
+
+    options = SplitOptions();
+    options.trackRanges = {{1, 4}};
+    options.nameRegex = "Guitar";
+    options.minSize = tracks[2].size();
+    CHECK(selected(options) == std::set<std::string>{"Rhythm Guitar"});
+
+    if (toolPath.empty()) return;
+    for (const char* size : {"+5", " 5", " -5", "-5", "5x", ""}) {
+        auto [status, output] = runTool({"--min-size", size, input.string(), "-o", (dir / "out").string()});
+        CHECK(status != 0 && output.find("Invalid value for --min-size") != std::string::npos);
+    }
+    auto [status, output] = runTool({"--min-size", "4K", "--max-size", "8k", input.string(), "-o", (dir / "out").string()});
+    CHECK(status == 0 && readOutputs(dir / "out").size() == 1 && fs::exists(dir / "out" / "band - Rhythm Guitar.mid"));
+}
+
+// --stats counts every event, the notes struck, the length in ticks, the most notes sounding at
+// once and the channels of each selected track, on one thread or several, and stops a track at
+// a malformed event
+void testStats(const fs::path& dir) {
+    std::vector<std::vector<uint8_t>> tracks = {
+        TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data,
+        TrackBuilder().meta(0, 0x03, "Keys").event(0, {0x90, 60, 100}).event(0, {64, 100}).event(0, {0x92, 67, 100})
+            .event(10, {0x80, 60, 0}).event(0, {0x90, 64, 0}).event(5, {0x82, 67, 0}).event(0, {0xB0, 7, 100}).end(5).data,
+        TrackBuilder().meta(0, 0x03, "Broken").event(0, {0x91, 60, 100}).event(10, {0xF4}).end().data,
+    };
+    fs::path input = dir / "counted.mid";
+    writeFile(input, buildFile(1, 96, tracks));
+
+    // Track number -> the columns after it
+    auto table = [&](const SplitOptions& options) {
+        std::ostringstream log;
+        MIDISplitter(log).statsMIDIFile(input.string(), options);
+        std::map<int, std::string> rows;
+        std::istringstream lines(log.str());
+        for (std::string line; std::getline(lines, line);) {
+            std::istringstream columns(line);
+            int number;
+            std::string rest;
+            if (columns >> number && std::getline(columns >> std::ws, rest)) rows[number] = rest;
+        }
+        return rows;
+    };
+    auto normalize = [](const std::string& text) {
+        std::istringstream words(text);
+        std::string word, joined;
+        while (words >> word) joined += (joined.empty() ? "" : " ") + word;
+        return joined;
+    };
+
+    for (unsigned jobs : {1u, 4u}) {
+        SplitOptions options;
+        options.jobs = jobs;
+        auto rows = table(options);
+        CHECK(rows.size() == 3);
+        CHECK(normalize(rows[1]) == "3 0 0 0 - / Tempo");
+        CHECK(normalize(rows[2]) == "9 3 20 3 1,3 / Keys");
+        CHECK(normalize(rows[3]).starts_with("2 1 ") && rows[3].ends_with("Broken (stopped at a malformed event)"));
+    }
+
+    SplitOptions options;
+    options.trackRanges = {{2, 2}};
+    auto rows = table(options);
+    CHECK(rows.size() == 1 && rows.count(2) == 1);
+    CHECK(fs::is_empty(dir / "out"));
+}
+
+// --conductor: every output but track 1's starts with a conductor track holding the tempo, time
+// signature and key signature events of track 1 at their ticks, also when track 1 is not
+// selected and when the input is read in one pass; without such events nothing is embedded
+void testConductor(const fs::path& dir) {
+    std::vector<uint8_t> tempo = TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20})
+        .event(0, {0xFF, 0x58, 0x04, 0x03, 0x02, 0x18, 0x08}).meta(10, 0x06, "Verse").event(10, {0xFF, 0x59, 0x02, 0x01, 0x00})
+        .event(76, {0xFF, 0x51, 0x03, 0x06, 0x1A, 0x80}).meta(0, 0x02, "(c)").end(104).data;
+    std::vector<uint8_t> conductor = TrackBuilder().event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20})
+        .event(0, {0xFF, 0x58, 0x04, 0x03, 0x02, 0x18, 0x08}).event(20, {0xFF, 0x59, 0x02, 0x01, 0x00})
+        .event(76, {0xFF, 0x51, 0x03, 0x06, 0x1A, 0x80}).end().data;
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> bass = TrackBuilder().meta(0, 0x03, "Bass").event(0, {0x91, 36, 100}).event(192, {36, 0}).end().data;
+    fs::path input = dir / "song.mid";
+    writeFile(input, buildFile(1, 96, {tempo, lead, bass}));
+
+    for (bool singlePass : {false, true}) {
+        fs::path out = dir / (singlePass ? "stream" : "mapped");
+        fs::create_directories(out);
+        std::ostringstream log;
+        SplitOptions options;
+        options.embedConductor = true;
+        options.singlePass = singlePass;
+        MIDISplitter(log).splitMIDIFile(input.string(), out.string(), options);
+        CHECK(readFile(out / "song - Tempo.mid") == buildFile(1, 96, {tempo}));
+        CHECK(readFile(out / "song - Lead.mid") == buildFile(1, 96, {conductor, lead}));
+        CHECK(readFile(out / "song - Bass.mid") == buildFile(1, 96, {conductor, bass}));
+
+        fs::path selected = out / "selected";
+        fs::create_directories(selected);
+        options.trackRanges = {{3, 3}};
+        MIDISplitter(log).splitMIDIFile(input.string(), selected.string(), options);
+        CHECK(readOutputs(selected) == (std::map<std::string, std::vector<uint8_t>>{{"song - Bass.mid", buildFile(1, 96, {conductor, bass})}}));
+    }
+
+    fs::path plainInput = dir / "untimed.mid";
+    writeFile(plainInput, buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, lead}));
+    std::ostringstream log;
+    SplitOptions options;
+    options.embedConductor = true;
+    MIDISplitter(log).splitMIDIFile(plainInput.string(), (dir / "out").string(), options);
+    CHECK(readFile(dir / "out" / "untimed - Lead.mid") == buildFile(1, 96, {lead}));
+    CHECK(log.str().find("no conductor embedded") != std::string::npos);
+}
+
+// The read-ahead buffer hands over a pipe's data unchanged however the writer chunks it, a named
+// pipe splits like the file written into it, and destroying the buffer while its writer keeps
+// the pipe open and silent does not wait for more input
+void testReadAhead(const fs::path& dir) {
+    std::vector<char> data(3 << 20);
+    for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<char>(i * 7 + i / 4096);
+    int ends[2];
+    CHECK(::pipe(ends) == 0);
+    std::thread writer([&] {
+        std::mt19937 random(3);
+        for (size_t pos = 0; pos < data.size();) {
+            size_t chunk = std::min<size_t>(data.size() - pos, 1 + random() % 70000);
+            writeAll(ends[1], reinterpret_cast<const uint8_t*>(data.data() + pos), chunk);
+            pos += chunk;
+        }
+        ::close(ends[1]);
+    });
+    {
+        ReadAheadBuffer readAhead(ends[0], 64 << 10, 4);
+        std::istream in(&readAhead);
+        std::vector<char> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        CHECK(received == data);
+    }
+    writer.join();
+    ::close(ends[0]);
+
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> source = buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, lead, buildLongTrack(200000)});
+    fs::path fifo = dir / "fifo.mid";
+    CHECK(::mkfifo(fifo.c_str(), 0600) == 0);
+    std::thread fifoWriter([&] { writeFile(fifo, source); });
+    std::ostringstream log;
+    MIDISplitter(log).splitMIDIFile(fifo.string(), (dir / "out").string());
+    fifoWriter.join();
+    CHECK(readFile(dir / "out" / "fifo - Lead.mid") == buildFile(1, 96, {lead}));
+    CHECK(readOutputs(dir / "out").size() == 3);
+
+    CHECK(::pipe(ends) == 0);
+    CHECK(::write(ends[1], "MThd", 4) == 4);
+    auto stopped = std::async(std::launch::async, [&] {
+        ReadAheadBuffer readAhead(ends[0]);
+        std::istream in(&readAhead);
+        char header[4];
+        in.read(header, 4);
+    });
+    bool done = stopped.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    CHECK(done);
+    ::close(ends[1]); // Lets a reader stuck in read() go
+    stopped.wait();
+    ::close(ends[0]);
+}
+
+// Splits of a batch that share a PlannedOutputs never pick the same output, though nothing is
+// written yet when the second one is planned: two inputs named alike, in different folders,
+// and a Format 0 file split in one pass while a channel name is planned by another split
+void testBatchNaming(const fs::path& dir) {
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> bass = TrackBuilder().meta(0, 0x03, "Bass").event(0, {0x91, 36, 100}).event(96, {36, 0}).end().data;
+    fs::create_directories(dir / "a");
+    fs::create_directories(dir / "b");
+    writeFile(dir / "a" / "song.mid", buildFile(1, 96, {lead}));
+    writeFile(dir / "b" / "song.mid", buildFile(1, 96, {lead, bass}));
+
+    std::ostringstream log;
+    MIDISplitter::PlannedOutputs planned;
+    MIDISplitter first(log), second(log);
+    MIDISplitter::SplitPlan firstPlan = first.planSplit((dir / "a" / "song.mid").string(), (dir / "out").string(), SplitOptions(), &planned);
+    MIDISplitter::SplitPlan secondPlan = second.planSplit((dir / "b" / "song.mid").string(), (dir / "out").string(), SplitOptions(), &planned);
+    CHECK(firstPlan.outputPaths == std::vector<fs::path>{dir / "out" / "song - Lead.mid"});
+    CHECK(secondPlan.outputPaths == (std::vector<fs::path>{dir / "out" / "song - Lead (Copy 1).mid", dir / "out" / "song - Bass.mid"}));
+    CHECK(planned.paths.size() == 3);
+
+    std::vector<uint8_t> format0 = TrackBuilder().meta(0, 0x03, "Mix").event(0, {0x90, 60, 100}).event(0, {0x91, 36, 100})
+        .event(96, {0x80, 60, 0}).event(0, {0x81, 36, 0}).end().data;
+    fs::create_directories(dir / "channels");
+    writeFile(dir / "a" / "mix.mid", buildFile(0, 96, {format0}));
+    planned.paths = {dir / "channels" / "mix - Channel 1.mid"};
+    MIDISplitter(log).splitMIDIFile((dir / "a" / "mix.mid").string(), (dir / "channels").string(), SplitOptions(), &planned);
+    std::map<std::string, std::vector<uint8_t>> channels = readOutputs(dir / "channels");
+    CHECK(channels.size() == 2);
+    CHECK(channels.count("mix - Channel 1 (Copy 1).mid") == 1);
+    CHECK(channels.count("mix - Channel 2.mid") == 1);
+    CHECK(planned.paths == std::set<fs::path>{dir / "channels" / "mix - Channel 1.mid"});
+
+    if (toolPath.empty()) return;
+    fs::path batch = dir / "batch";
+    auto [status, output] = runTool({(dir / "a" / "song.mid").string(), (dir / "b" / "song.mid").string(), "-o", batch.string(), "--jobs", "4"});
+    CHECK(status == 0);
+    std::map<std::string, std::vector<uint8_t>> outputs = readOutputs(batch);
+    CHECK(outputs.size() == 3);
+    CHECK(outputs["song - Lead.mid"] == buildFile(1, 96, {lead}));
+    CHECK(outputs["song - Lead (Copy 1).mid"] == buildFile(1, 96, {lead}));
+    CHECK(outputs["song - Bass.mid"] == buildFile(1, 96, {bass}));
+}
+
+// --watch splits a file written into the spool folder and one renamed into it, and SIGTERM stops
+// it with exit code 0, even when it was started with SIGTERM ignored
+void testWatch(const fs::path& dir) {
+    if (toolPath.empty()) return;
+    fs::path spool = dir / "spool";
+    fs::create_directories(spool);
+    fs::path logPath = dir / "watch.log";
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> source = buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, lead});
+
+    pid_t child = ::fork();
+    if (child == 0) {
+        int log = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        ::dup2(log, STDOUT_FILENO);
+        ::dup2(log, STDERR_FILENO);
+        ::signal(SIGTERM, SIG_IGN);
+        ::execl(toolPath.c_str(), toolPath.c_str(), "--watch", spool.c_str(), "-o", (dir / "out").c_str(), static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    CHECK(child > 0);
+    if (child < 0) return;
+
+    auto waitFor = [](const std::function<bool()>& done) {
+        for (int i = 0; i < 1000; i++) {
+            if (done()) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    };
+    auto logged = [&](const std::string& text) {
+        std::vector<uint8_t> log = fs::exists(logPath) ? readFile(logPath) : std::vector<uint8_t>();
+        return std::string(log.begin(), log.end()).find(text) != std::string::npos;
+    };
+    CHECK(waitFor([&] { return logged("Watching"); }));
+    writeFile(spool / "written.mid", source);
+    writeFile(dir / "renamed.mid", source);
+    fs::rename(dir / "renamed.mid", spool / "renamed.mid");
+    CHECK(waitFor([&] { return logged("written.mid") && logged("renamed.mid") && readOutputs(dir / "out").size() == 4; }));
+
+    ::kill(child, SIGTERM);
+    int status = 0;
+    bool exited = waitFor([&] { return ::waitpid(child, &status, WNOHANG) == child; });
+    CHECK(exited);
+    if (!exited) {
+        ::kill(child, SIGKILL);
+        ::waitpid(child, &status, 0);
+    }
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(readFile(dir / "out" / "written - Lead.mid") == buildFile(1, 96, {lead}));
+    CHECK(readFile(dir / "out" / "renamed - Lead.mid") == buildFile(1, 96, {lead}));
+}
+
+// Collects the outputs a MidiFile delivers, checking that begin, write and end come in order and
+// that begin announces the size that is written
+class CollectingSink : public midisplitter::TrackSink {
+public:
+    void begin(const midisplitter::TrackEntry& track, uint64_t outputSize) override {
+        CHECK(!open_);
+        open_ = true;
+        announced_ = outputSize;
+        current_ = &outputs[track.number];
+        current_->clear();
+    }
+
+    void write(std::span<const uint8_t> data) override {
+        CHECK(open_);
+        if (current_) current_->insert(current_->end(), data.begin(), data.end());
+    }
+
+    void end(const midisplitter::TrackEntry& track) override {
+        CHECK(open_ && outputs[track.number].size() == announced_);
+        open_ = false;
+        ended.push_back(track.number);
+    }
+
+    std::map<uint16_t, std::vector<uint8_t>> outputs;
+    std::vector<uint16_t> ended;
+
+private:
+    bool open_ = false;
+    uint64_t announced_ = 0;
+    std::vector<uint8_t>* current_ = nullptr;
+};
+
+// MidiFile lists the tracks and delivers each one's output to a TrackSink byte for byte as the
+// splitter writes it, with a corrected MTrk length for a recovered track and the conductor track
+// when asked; trackBytes is the chunk as in the input
+void testLibraryExtract(const fs::path& dir) {
+    std::vector<uint8_t> tempo = TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data;
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").meta(0, 0x04, "Synth").event(0, {0xC1, 80})
+        .event(0, {0x91, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> bass = TrackBuilder().meta(0, 0x03, "Bass").event(0, {0x92, 36, 100}).event(192, {36, 0}).end().data;
+    fs::path input = dir / "song.mid";
+    std::vector<uint8_t> source = buildFile(1, 96, {tempo, lead, bass}, {{1, 5}});
+    writeFile(input, source);
+
+    midisplitter::MidiFile file(input.string());
+    CHECK(file.header().format == 1 && file.header().trackCount == 3 && file.header().division == 96);
+    std::span<const midisplitter::TrackEntry> tracks = file.tracks();
+    CHECK(tracks.size() == 3);
+    if (tracks.size() != 3) return;
+    CHECK(tracks[1].number == 2 && tracks[1].name == "Lead" && tracks[1].instrument == "Synth");
+    CHECK(tracks[1].program == 80 && tracks[1].channels == 0x0002 && tracks[1].recovered);
+    CHECK(tracks[1].offset == 14 + 8 + tempo.size() && tracks[1].size == lead.size());
+    CHECK(tracks[2].program == -1 && !tracks[2].recovered);
+    std::span<const uint8_t> chunk = file.trackBytes(2);
+    CHECK(std::vector<uint8_t>(chunk.begin(), chunk.end()) == std::vector<uint8_t>(source.end() - 8 - bass.size(), source.end()));
+
+    CollectingSink sink;
+    file.split(sink);
+    CHECK(sink.ended == (std::vector<uint16_t>{1, 2, 3}));
+    std::ostringstream log;
+    MIDISplitter(log).splitMIDIFile(input.string(), (dir / "out").string());
+    CHECK(sink.outputs[1] == readFile(dir / "out" / "song - Tempo.mid"));
+    CHECK(sink.outputs[2] == readFile(dir / "out" / "song - Lead.mid"));
+    CHECK(sink.outputs[2] == buildFile(1, 96, {lead}));
+    CHECK(sink.outputs[3] == readFile(dir / "out" / "song - Bass.mid"));
+
+    std::vector<uint8_t> conductor = TrackBuilder().event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data;
+    CollectingSink withConductor;
+    file.extract(2, withConductor, {.embedConductor = true});
+    file.extract(0, withConductor, {.embedConductor = true});
+    CHECK(withConductor.ended == (std::vector<uint16_t>{3, 1}));
+    CHECK(withConductor.outputs[3] == buildFile(1, 96, {conductor, bass}));
+    CHECK(withConductor.outputs[1] == buildFile(1, 96, {tempo}));
+
+    bool rejected = false;
+    try {
+        file.extract(3, sink);
+    } catch (const std::exception&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    rejected = false;
+    try {
+        midisplitter::MidiFile missing((dir / "missing.mid").string());
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+// The C interface: its return codes, names cut to the caller's buffer with their full lengths,
+// outputs written to a descriptor as a split writes them, EPIPE instead of SIGPIPE from a closed
+// pipe or socket, and the message of the last failure, kept per thread
+void testCInterface(const fs::path& dir) {
+    CHECK(msplit_abi_version() == MSPLIT_ABI_VERSION);
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead Synth").meta(0, 0x04, "Saw").event(0, {0x90, 60, 100})
+        .event(96, {60, 0}).end().data;
+    fs::path input = dir / "song.mid";
+    writeFile(input, buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, lead, buildLongTrack(200000)}));
+
+    msplit_file* file = reinterpret_cast<msplit_file*>(&file);
+    CHECK(msplit_open((dir / "missing.mid").c_str(), 0, &file) == MSPLIT_ERR_FAILED && file == nullptr);
+    char message[8];
+    size_t messageLength = msplit_last_error(message, sizeof(message));
+    CHECK(messageLength > sizeof(message) && std::strlen(message) == sizeof(message) - 1);
+    std::string fullMessage(messageLength, '\0');
+    CHECK(msplit_last_error(fullMessage.data(), messageLength + 1) == messageLength);
+    CHECK(fullMessage.compare(0, sizeof(message) - 1, message) == 0);
+    std::thread([] { CHECK(msplit_last_error(nullptr, 0) == 0); }).join();
+    CHECK(msplit_open(nullptr, 0, &file) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_open(input.c_str(), 0, nullptr) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_track_count(nullptr) == 0);
+
+    CHECK(msplit_open(input.c_str(), 0, &file) == MSPLIT_OK);
+    if (file == nullptr) return;
+    CHECK(msplit_track_count(file) == 3);
+    msplit_track info;
+    char name[5], instrument[16];
+    CHECK(msplit_track_info(file, 1, &info, name, sizeof(name), instrument, sizeof(instrument)) == MSPLIT_OK);
+    CHECK(std::string(name) == "Lead" && info.name_length == 10);
+    CHECK(std::string(instrument) == "Saw" && info.instrument_length == 3);
+    CHECK(info.number == 2 && info.program == -1 && info.channels == 0x0001 && info.recovered == 0);
+    CHECK(info.offset == 14 + 8 + 4 + 5 + 4 && info.size == lead.size());
+    CHECK(msplit_track_info(file, 1, &info, nullptr, 0, nullptr, 0) == MSPLIT_OK && info.name_length == 10);
+    CHECK(msplit_track_info(file, 3, &info, nullptr, 0, nullptr, 0) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_track_info(nullptr, 0, &info, nullptr, 0, nullptr, 0) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_track_info(file, 0, nullptr, nullptr, 0, nullptr, 0) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_extract_to_fd(file, 3, STDOUT_FILENO, 0) == MSPLIT_ERR_ARGUMENT);
+    CHECK(msplit_extract_to_fd(nullptr, 0, STDOUT_FILENO, 0) == MSPLIT_ERR_ARGUMENT);
+
+    std::ostringstream log;
+    MIDISplitter(log).splitMIDIFile(input.string(), (dir / "out").string());
+    for (auto [index, output] : {std::pair<size_t, const char*>{1, "song - Lead Synth.mid"}, {2, "song - Piano.mid"}}) {
+        fs::path extracted = dir / "extracted.mid";
+        int fd = ::open(extracted.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        CHECK(msplit_extract_to_fd(file, index, fd, 0) == MSPLIT_OK);
+        ::close(fd);
+        CHECK(readFile(extracted) == readFile(dir / "out" / output));
+    }
+
+    // The long track does not fit in the buffer of a pipe or socket, so the write fails once the
+    // other end is closed; a SIGPIPE would end the test here
+    int ends[2];
+    CHECK(::pipe(ends) == 0);
+    ::close(ends[0]);
+    errno = 0;
+    CHECK(msplit_extract_to_fd(file, 2, ends[1], 0) == MSPLIT_ERR_IO && errno == EPIPE);
+    ::close(ends[1]);
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, ends) == 0);
+    ::close(ends[0]);
+    errno = 0;
+    CHECK(msplit_extract_to_fd(file, 2, ends[1], MSPLIT_CONDUCTOR) == MSPLIT_ERR_IO && errno == EPIPE);
+    ::close(ends[1]);
+    CHECK(msplit_last_error(nullptr, 0) > 0);
+    msplit_close(file);
+    msplit_close(nullptr);
+}
+
+// --max-part-size: every part parses on its own and fits, ends with no notes left sounding, and
+// plays the original events at their original ticks under the controllers, programs and pitch
+// bends in effect there, with the notes that were sounding at a cut struck again
+void testPartsReparse(const fs::path& dir) {
+    const uint64_t maxPartSize = 64 << 10;
+    std::vector<uint8_t> source = buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, buildLongTrack(40000)});
+    writeFile(dir / "long.mid", source);
+    std::vector<Event> original = parseFile(source).tracks[1];
+
+    std::ostringstream log;
+    SplitOptions options;
+    options.maxPartSize = maxPartSize;
+    MIDISplitter(log).splitMIDIFile((dir / "long.mid").string(), (dir / "out").string(), options);
+
+    std::vector<fs::path> parts = filesMatching(dir / "out", "Piano (part ");
+    CHECK(parts.size() >= 3);
+
+    // Control state and sounding notes at every original channel event
+    std::vector<ChannelState> originalStates;
+    ChannelState originalState;
+    for (const Event& event : original) {
+        if (event.isChannel()) {
+            originalStates.push_back(originalState);
+            originalState.apply(event);
+        }
+    }
+    std::vector<Event> originalChannel = channelEvents(original);
+
+    size_t matched = 0;
+    uint64_t lastTick = 0;
+    for (const fs::path& path : parts) {
+        std::vector<uint8_t> bytes = readFile(path);
+        CHECK(bytes.size() <= maxPartSize);
+        ParsedFile part = parseFile(bytes);
+        CHECK(part.tracks.size() == 1 && part.division == 96);
+        if (part.tracks.size() != 1) continue;
+
+        const std::vector<Event>& events = part.tracks[0];
+        CHECK(events.size() > 2 && events[0].bytes == std::vector<uint8_t>({0xFF, 0x03, 5, 'P', 'i', 'a', 'n', 'o'}));
+
+        // The original events come in order, each seeing the state it had in the source
+        ChannelState state;
+        for (const Event& event : events) {
+            if (!event.isChannel()) continue;
+            if (matched < originalChannel.size() && event == originalChannel[matched]) {
+                CHECK(state.sameControls(originalStates[matched]));
+                if (event.isNoteOff()) {
+                    CHECK(state.sounding[{event.bytes[0] & 0x0F, event.bytes[1]}] > 0);
+                }
+                matched++;
+            }
+            state.apply(event);
+        }
+        CHECK(state.notesSounding() == 0);
+        CHECK(events.back().tick >= lastTick);
+        lastTick = events.back().tick;
+    }
+    CHECK(matched == originalChannel.size());
+    CHECK(lastTick == original.back().tick);
+
+    // Splitting again leaves these parts alone and cuts the track under a new name
+    MIDISplitter(log).splitMIDIFile((dir / "long.mid").string(), (dir / "out").string(), options);
+    CHECK(filesMatching(dir / "out", "Piano (part ").size() == parts.size());
+    CHECK(filesMatching(dir / "out", "Piano (Copy 1) (part ").size() == parts.size());
+}
+
+// A track that cannot be cut (here an undefined status byte near its end) leaves none of its
+// parts behind, neither the part that failed nor the ones written before it
+void testPartsRemovedOnError(const fs::path& dir) {
+    std::vector<uint8_t> track = buildLongTrack(40000);
+    track.resize(track.size() - 4); // Drop End of Track
+    appendVarLen(track, 0);
+    track.push_back(0xF4);
+    track.insert(track.end(), {0x00, 0xFF, 0x2F, 0x00});
+    writeFile(dir / "bad.mid", buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, track}));
+
+    std::ostringstream log;
+    SplitOptions options;
+    options.maxPartSize = 64 << 10;
+    bool failed = false;
+    try {
+        MIDISplitter(log).splitMIDIFile((dir / "bad.mid").string(), (dir / "out").string(), options);
+    } catch (const std::exception& e) {
+        failed = std::string(e.what()).find("Cannot cut track 2") != std::string::npos;
+    }
+    CHECK(failed);
+    CHECK(filesMatching(dir / "out", "Piano").empty());
+}
+
+// A Format 0 file is split into one output per channel and merged back into the same events
+void testFormat0RoundTrip(const fs::path& dir) {
+    TrackBuilder track;
+    track.meta(0, 0x03, "Song").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20});
+    track.event(0, {0xC0, 1}).event(0, {0xC1, 33}).event(0, {0xB9, 7, 110});
+    for (uint8_t i = 0; i < 50; i++) {
+        track.event(10, {0x90, static_cast<uint8_t>(60 + i % 12), 80}).event(0, {static_cast<uint8_t>(64 + i % 12), 80});
+        track.event(5, {0x91, static_cast<uint8_t>(36 + i % 7), 100});
+        track.event(5, {0x99, 42, 90}).event(1, {42, 0}); // Running status on channel 10
+        track.event(4, {0x80, static_cast<uint8_t>(60 + i % 12), 0}).event(0, {static_cast<uint8_t>(64 + i % 12), 0});
+        track.event(0, {0x81, static_cast<uint8_t>(36 + i % 7), 0});
+    }
+    // Channel 4 only starts after a lyric and a tempo change
+    track.meta(10, 0x05, "la").event(0, {0xFF, 0x51, 0x03, 0x06, 0x1A, 0x80});
+    track.event(5, {0x93, 48, 70}).event(10, {48, 0});
+    track.end(20);
+    std::vector<uint8_t> source = buildFile(0, 480, {track.data});
+    writeFile(dir / "song.mid", source);
+    std::vector<Event> original = parseFile(source).tracks[0];
+
+    std::ostringstream log;
+    MIDISplitter(log).splitMIDIFile((dir / "song.mid").string(), (dir / "out").string());
+
+    // One output per channel used, with that channel's events and the shared events from the
+    // time it opened; the late channel starts with the name and the tempo then in effect only
+    const Event& lyric = original[original.size() - 5];
+    const Event& tempoChange = original[original.size() - 4];
+    std::vector<std::string> inputs;
+    for (int channel : {0, 1, 9, 3}) {
+        fs::path path = dir / "out" / ("song - Channel " + std::to_string(channel + 1) + ".mid");
+        CHECK(fs::exists(path));
+        if (!fs::exists(path)) return;
+        ParsedFile output = parseFile(readFile(path));
+        CHECK(output.tracks.size() == 1 && output.division == 480);
+        if (output.tracks.size() != 1) return;
+        const std::vector<Event>& events = output.tracks[0];
+        CHECK(channelEvents(events) == channelEvents(original, channel));
+        CHECK(events[0] == original[0]);
+        CHECK(std::count(events.begin(), events.end(), original[1]) == (channel == 3 ? 0 : 1));
+        CHECK(std::count(events.begin(), events.end(), lyric) == (channel == 3 ? 0 : 1));
+        CHECK(std::count(events.begin(), events.end(), tempoChange) == 1);
+        inputs.push_back(path.string());
+    }
+    CHECK(filesMatching(dir / "out", "Channel").size() == 4);
+
+    MIDISplitter(log).mergeMIDIFiles(inputs, (dir / "merged.mid").string());
+    ParsedFile merged = parseFile(readFile(dir / "merged.mid"));
+    CHECK(merged.format == 0 && merged.tracks.size() == 1 && merged.division == 480);
+    if (merged.tracks.size() != 1) return;
+    for (int channel : {0, 1, 9, 3}) {
+        CHECK(channelEvents(merged.tracks[0], channel) == channelEvents(original, channel));
+    }
+    CHECK(channelEvents(merged.tracks[0]).size() == channelEvents(original).size());
+    CHECK(std::count(merged.tracks[0].begin(), merged.tracks[0].end(), original[1]) == 1); // Tempo once
+    CHECK(std::count_if(merged.tracks[0].begin(), merged.tracks[0].end(),
+                        [](const Event& event) { return event.bytes[0] == 0xFF && event.bytes[1] == 0x03; }) == 1);
+    CHECK(merged.tracks[0].back().tick == original.back().tick);
+}
+
+// A Format 0 file with an undefined status byte stops the split, and the channel outputs opened
+// before it are removed instead of being left without their end
+void testFormat0RemovedOnError(const fs::path& dir) {
+    TrackBuilder track;
+    track.event(0, {0x90, 60, 100}).event(0, {0x91, 48, 100}).event(96, {0x80, 60, 0}).event(0, {0xF4});
+    track.event(0, {0x81, 48, 0}).end();
+    writeFile(dir / "bad0.mid", buildFile(0, 96, {track.data}));
+
+    std::ostringstream log;
+    bool failed = false;
+    try {
+        MIDISplitter(log).splitMIDIFile((dir / "bad0.mid").string(), (dir / "out").string());
+    } catch (const std::exception&) {
+        failed = true;
+    }
+    CHECK(failed);
+    CHECK(filesMatching(dir / "out", "Channel").empty());
+}
+
+// A track whose MTrk header gives a wrong length is measured from its End of Track, and split
+// with a corrected header, as are the tracks after it
+void testRecoveredLength(const fs::path& dir) {
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> bass = TrackBuilder().meta(0, 0x03, "Bass").event(0, {0x91, 36, 100}).event(192, {36, 0}).end().data;
+    std::vector<uint8_t> source = buildFile(1, 96, {TrackBuilder().meta(0, 0x03, "Tempo").end().data, lead, bass}, {{1, 5}});
+    writeFile(dir / "broken.mid", source);
+
+    std::ostringstream log;
+    MIDISplitter splitter(log);
+    auto plan = splitter.planSplit((dir / "broken.mid").string(), (dir / "out").string(), SplitOptions());
+    CHECK(plan.tracks.size() == 3);
+    if (plan.tracks.size() != 3) return;
+    CHECK(plan.tracks[1].recovered() && plan.tracks[1].declaredSize == 5 && plan.tracks[1].size == lead.size());
+    CHECK(!plan.tracks[2].recovered() && plan.tracks[2].position == 14 + 8 + plan.tracks[0].size + 8 + lead.size());
+    CHECK(plan.tracks[2].name == "Bass");
+    plan = {};
+
+    splitter.splitMIDIFile((dir / "broken.mid").string(), (dir / "out").string());
+    for (const auto& [name, data] : {std::pair{"Lead", lead}, std::pair{"Bass", bass}}) {
+        std::vector<uint8_t> output = readFile(dir / "out" / (std::string("broken - ") + name + ".mid"));
+        std::vector<uint8_t> expected = buildFile(1, 96, {data});
+        CHECK(output == expected);
+    }
+}
+
+// An output of --reflink has an XPAD chunk between MThd and MTrk; splitting it (mapped and in
+// one pass), inspecting, indexing and merging it read the track behind the padding
+void testPaddedInput(const fs::path& dir) {
+    std::vector<uint8_t> track = TrackBuilder().meta(0, 0x03, "Flute").event(0, {0x90, 72, 90}).event(48, {72, 0}).end().data;
+    std::vector<uint8_t> plain = buildFile(1, 96, {track});
+    std::vector<uint8_t> padded(plain.begin(), plain.begin() + 14);
+    std::vector<uint8_t> padding = foreignChunk("XPAD", std::string(4082, '\0'));
+    padded.insert(padded.end(), padding.begin(), padding.end());
+    padded.insert(padded.end(), plain.begin() + 14, plain.end());
+    fs::path input = dir / "padded.mid";
+    writeFile(input, padded);
+
+    std::ostringstream log;
+    std::ostringstream json;
+    MIDISplitter(log).inspectMIDIFile(input.string(), json);
+    CHECK(json.str().find("\"offset\": " + std::to_string(14 + padding.size())) != std::string::npos);
+    CHECK(json.str().find("\"name\": \"Flute\"") != std::string::npos && json.str().find("error") == std::string::npos);
+
+    SplitOptions options;
+    options.useIndex = true;
+    MIDISplitter(log).splitMIDIFile(input.string(), (dir / "out").string(), options);
+    CHECK(fs::exists(dir / "padded.mid.midx"));
+    CHECK(readFile(dir / "out" / "padded - Flute.mid") == plain);
+
+    auto plan = MIDISplitter(log).planSplit(input.string(), (dir / "out").string(), options);
+    CHECK(log.str().find("Loaded track index") != std::string::npos);
+    CHECK(plan.tracks.size() == 1 && plan.tracks[0].position == 14 + padding.size() && !plan.tracks[0].recovered());
+    plan = {};
+
+    options = SplitOptions();
+    options.singlePass = true;
+    fs::create_directories(dir / "stream");
+    MIDISplitter(log).splitMIDIFile(input.string(), (dir / "stream").string(), options);
+    CHECK(readFile(dir / "stream" / "padded - Flute.mid") == plain);
+
+    MIDISplitter(log).mergeMIDIFiles({input.string()}, (dir / "merged.mid").string());
+    ParsedFile merged = parseFile(readFile(dir / "merged.mid"));
+    CHECK(merged.tracks.size() == 1 && merged.tracks[0] == parseFile(plain).tracks[0]);
+}
+
+// A foreign chunk after a track whose length is right ends that track cleanly: the track is not
+// measured again and its output does not take the chunk in, split from the mapping or in one pass
+void testForeignChunkBetweenTracks(const fs::path& dir) {
+    std::vector<uint8_t> tempo = TrackBuilder().meta(0, 0x03, "Tempo").event(0, {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20}).end().data;
+    std::vector<uint8_t> lead = TrackBuilder().meta(0, 0x03, "Lead").event(0, {0x90, 60, 100}).event(96, {60, 0}).end().data;
+    std::vector<uint8_t> bass = TrackBuilder().meta(0, 0x03, "Bass").event(0, {0x91, 36, 100}).event(96, {36, 0}).end().data;
+    std::vector<uint8_t> source = buildFile(1, 96, {tempo, lead, bass});
+    std::vector<uint8_t> chunk = foreignChunk("XFOO", "hello");
+    source.insert(source.begin() + 14 + 8 + tempo.size(), chunk.begin(), chunk.end());
+    writeFile(dir / "alien.mid", source);
+
+    for (bool singlePass : {false, true}) {
+        fs::path out = dir / (singlePass ? "stream" : "out");
+        fs::create_directories(out);
+        std::ostringstream log;
+        SplitOptions options;
+        options.singlePass = singlePass;
+        MIDISplitter(log).splitMIDIFile((dir / "alien.mid").string(), out.string(), options);
+        CHECK(log.str().find("declares") == std::string::npos);
+        for (const auto& [name, data] : {std::pair{"Tempo", tempo}, std::pair{"Lead", lead}, std::pair{"Bass", bass}}) {
+            CHECK(readFile(out / (std::string("alien - ") + name + ".mid")) == buildFile(1, 96, {data}));
+        }
+    }
+}
+
+// --index writes a .midx next to the input, loads it while the input is unchanged and rebuilds
+// it when its records do not match the input
+void testTrackIndex(const fs::path& dir) {
+    std::vector<std::vector<uint8_t>> tracks = {
+        TrackBuilder().meta(0, 0x03, "Tempo").end().data,
+        TrackBuilder().meta(0, 0x03, "Strings").meta(0, 0x04, "Violins").event(0, {0xC0, 48}).event(10, {0x90, 67, 70}).event(10, {67, 0}).end().data,
+        TrackBuilder().meta(0, 0x04, "Kit").event(0, {0x99, 36, 100}).event(10, {36, 0}).end().data,
+    };
+    std::vector<uint8_t> source = buildFile(1, 120, tracks);
+    fs::path input = dir / "indexed.mid";
+    writeFile(input, source);
+    fs::path indexPath = dir / "indexed.mid.midx";
+
+    SplitOptions options;
+    options.useIndex = true;
+    auto planWithIndex = [&](std::string& log) {
+        std::ostringstream stream;
+        auto plan = MIDISplitter(stream).planSplit(input.string(), (dir / "out").string(), options);
+        log = stream.str();
+        return plan;
+    };
+
+    std::string log;
+    auto scanned = planWithIndex(log);
+    CHECK(log.find("Saved track index") != std::string::npos);
+    CHECK(fs::exists(indexPath));
+
+    // Header: magic, version, input size, modification time and hash, then the MThd fields;
+    // a 44-byte record per track, then the names
+    std::vector<uint8_t> index = readFile(indexPath);
+    CHECK(index.size() >= 40 + 3 * 44);
+    if (index.size() < 40 + 3 * 44) return;
+    CHECK(std::memcmp(index.data(), "MIDX", 4) == 0 && readBigEndian(index, 4, 4) == 3);
+    CHECK(readBigEndian(index, 8, 8) == source.size());
+    CHECK(readBigEndian(index, 32, 2) == 1 && readBigEndian(index, 34, 2) == 3 && readBigEndian(index, 36, 2) == 120);
+    uint64_t position = 14;
+    for (size_t i = 0; i < 3; i++) {
+        size_t record = 40 + i * 44;
+        CHECK(readBigEndian(index, record, 8) == position);
+        CHECK(readBigEndian(index, record + 8, 8) == tracks[i].size());
+        CHECK(readBigEndian(index, record + 16, 4) == tracks[i].size());
+        CHECK(readBigEndian(index, record + 36, 2) == i + 1);
+        position += 8 + tracks[i].size();
+    }
+    size_t strings = 40 + 44;
+    auto text = [&](size_t offset, size_t length) {
+        size_t names = 40 + 3 * 44;
+        return std::string(index.begin() + names + offset, index.begin() + names + offset + length);
+    };
+    CHECK(text(readBigEndian(index, strings + 20, 4), readBigEndian(index, strings + 24, 4)) == "Strings");
+    CHECK(text(readBigEndian(index, strings + 28, 4), readBigEndian(index, strings + 32, 4)) == "Violins");
+    CHECK(readBigEndian(index, strings + 38, 2) == 48 && readBigEndian(index, strings + 40, 2) == 1);
+    CHECK(readBigEndian(index, 40 + 2 * 44 + 38, 2) == 0xFFFF && readBigEndian(index, 40 + 2 * 44 + 40, 2) == 1u << 9);
+
+    auto loaded = planWithIndex(log);
+    CHECK(log.find("Loaded track index") != std::string::npos);
+    CHECK(loaded.tracks.size() == scanned.tracks.size());
+    for (size_t i = 0; i < loaded.tracks.size() && i < scanned.tracks.size(); i++) {
+        CHECK(loaded.tracks[i].position == scanned.tracks[i].position && loaded.tracks[i].size == scanned.tracks[i].size);
+        CHECK(loaded.tracks[i].name == scanned.tracks[i].name && loaded.tracks[i].instrument == scanned.tracks[i].instrument);
+        CHECK(loaded.tracks[i].program == scanned.tracks[i].program && loaded.tracks[i].channels == scanned.tracks[i].channels);
+    }
+
+    // A record pointing between tracks is not trusted
+    index[40 + 44 + 7] += 3;
+    writeFile(indexPath, index);
+    auto rebuilt = planWithIndex(log);
+    CHECK(log.find("Loaded track index") == std::string::npos && log.find("Saved track index") != std::string::npos);
+    CHECK(rebuilt.tracks.size() == 3 && rebuilt.tracks[1].position == scanned.tracks[1].position);
+}
+
+// Edge cases of the one event decoder: data that runs out may still be completed, anything else
+// that does not parse never will be
+void testEventDecoder(const fs::path&) {
+    auto parse = [](std::vector<uint8_t> bytes, uint8_t runningStatus = 0) {
+        TrackEvent event;
+        return nextEvent(bytes, 0, runningStatus, event);
+    };
+    CHECK(parse({0x00, 0x90, 60, 100}) == EventParse::Ok);
+    CHECK(parse({0x00, 60, 100}, 0x90) == EventParse::Ok);
+    CHECK(parse({0x00, 60, 100}) == EventParse::Malformed);                         // Running status without a status
+    CHECK(parse({0x81, 0x80}) == EventParse::Truncated);                            // Delta-time cut off
+    CHECK(parse({0x81, 0x81, 0x81, 0x81, 0x00, 0x90, 60, 100}) == EventParse::Malformed); // Delta-time over four bytes
+    CHECK(parse({0x00, 0x90, 60}) == EventParse::Truncated);
+    CHECK(parse({0x00, 0x90, 60, 0x80}) == EventParse::Malformed);                  // Data byte with the top bit set
+    for (uint8_t status : {0xF1, 0xF2, 0xF3, 0xF6, 0xF8, 0xFE}) {
+        CHECK(parse({0x00, status, 0x00, 0x00}) == EventParse::Malformed);
+    }
+    CHECK(parse({0x00, 0xFF, 0x01, 0x03, 'a', 'b'}) == EventParse::Truncated);      // Meta length past the data
+    CHECK(parse({0x00, 0xFF, 0x01, 0xFF, 0xFF, 0xFF, 0x7F, 'a'}) == EventParse::Truncated);
+    CHECK(parse({0x00, 0xFF, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F}) == EventParse::Malformed);
+    CHECK(parse({0x00, 0xF0, 0x02, 0x01, 0xF7}) == EventParse::Ok);
+
+    // A stream decodes the same events through a buffer smaller than some of them
+    TrackBuilder track;
+    track.event(0, {0x90, 60, 100}).event(10, {60, 0});
+    std::string text(300, 'x');
+    track.meta(5, 0x01, text).event(0, {0xC0, 3}).end();
+    std::istringstream in(std::string(track.data.begin(), track.data.end()));
+    StreamReader reader(in, track.data.size(), 16);
+    TrackEvent event;
+    std::span<const uint8_t> bytes;
+    uint8_t runningStatus = 0;
+    std::vector<size_t> sizes;
+    while (reader.next(runningStatus, event, bytes) == EventParse::Ok) {
+        sizes.push_back(bytes.size());
+        runningStatus = runningStatusAfter(event);
+    }
+    CHECK(sizes == std::vector<size_t>({4, 3, 1 + 2 + 2 + text.size(), 3, 4}));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1) toolPath = fs::absolute(argv[1]).string();
+    fs::path root = fs::temp_directory_path() / ("midisplitter_test_" + std::to_string(::getpid()));
+    const std::pair<const char*, void (*)(const fs::path&)> tests[] = {
+        {"event decoder", testEventDecoder},
+        {"plain split", testPlainSplit},
+        {"writer modes match", testWriterModesMatch},
+        {"free space check", testFreeSpaceCheck},
+        {"name meta finders", testNameMetaFinders},
+        {"inspect JSON", testInspectJson},
+        {"selectors", testSelectors},
+        {"stats", testStats},
+        {"conductor", testConductor},
+        {"read-ahead", testReadAhead},
+        {"batch naming", testBatchNaming},
+        {"watch", testWatch},
+        {"library extract", testLibraryExtract},
+        {"C interface", testCInterface},
+        {"parts re-parse", testPartsReparse},
+        {"parts removed on error", testPartsRemovedOnError},
+        {"Format 0 split and merge", testFormat0RoundTrip},
+        {"Format 0 outputs removed on error", testFormat0RemovedOnError},
+        {"recovered track length", testRecoveredLength},
+        {"track index", testTrackIndex},
+        {"padded input", testPaddedInput},
+        {"foreign chunk between tracks", testForeignChunkBetweenTracks},
+    };
+    for (const auto& [name, test] : tests) {
+        std::cout << name << std::endl;
+        int before = failures;
+        fs::path dir = root / name;
+        fs::create_directories(dir / "out");
+        try {
+            test(dir);
+        } catch (const std::exception& e) {
+            std::cerr << "  FAILED: " << e.what() << std::endl;
+            failures++;
+        }
+        if (failures == before) fs::remove_all(dir);
+    }
+    if (failures == 0) fs::remove_all(root);
+
+    std::cout << (failures == 0 ? "All tests passed" : std::to_string(failures) + " checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}